@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * OmniVision OV5647 sensor driver: private controls, events and subdev
+ * ioctls.
+ */
+
+#ifndef __UAPI_OV5647_H__
+#define __UAPI_OV5647_H__
+
+#include <linux/types.h>
+#include <linux/videodev2.h>
+
+/*
+ * The base for the ov5647 driver controls, 16 controls wide. It is private
+ * to this driver: linux/v4l2-controls.h reserves no range for it, so the
+ * IDs are only meaningful on this driver's subdev node.
+ */
+#define V4L2_CID_USER_OV5647_BASE		(V4L2_CID_USER_BASE + 0x11f0)
+
+/* Tuning of the on-sensor AEC/AGC loop */
+#define V4L2_CID_OV5647_AEC_TARGET		(V4L2_CID_USER_OV5647_BASE + 0)
+#define V4L2_CID_OV5647_AEC_STABLE_RANGE	(V4L2_CID_USER_OV5647_BASE + 1)
+#define V4L2_CID_OV5647_AEC_FAST_HIGH		(V4L2_CID_USER_OV5647_BASE + 2)
+#define V4L2_CID_OV5647_AEC_FAST_LOW		(V4L2_CID_USER_OV5647_BASE + 3)
+#define V4L2_CID_OV5647_AGC_CEILING		(V4L2_CID_USER_OV5647_BASE + 4)
+
+/*
+ * Controls named in ov5647_event_ctrls_applied.dirty and, for the first
+ * three, in ov5647_frame_ctrls.which
+ */
+#define OV5647_CTRL_EXPOSURE			(1 << 0)
+#define OV5647_CTRL_GAIN			(1 << 1)
+#define OV5647_CTRL_VBLANK			(1 << 2)
+#define OV5647_CTRL_AUTOGAIN			(1 << 3)
+#define OV5647_CTRL_EXPOSURE_AUTO		(1 << 4)
+#define OV5647_CTRL_AWB				(1 << 5)
+#define OV5647_CTRL_VFLIP			(1 << 6)
+#define OV5647_CTRL_HFLIP			(1 << 7)
+
+/*
+ * Sent once a deferred control batch has been written to the sensor, see
+ * the async_ctrls module parameter.
+ */
+#define V4L2_EVENT_OV5647_CTRLS_APPLIED		(V4L2_EVENT_PRIVATE_START + 0x5647)
+
+/* V4L2_EVENT_OV5647_CTRLS_APPLIED payload */
+struct ov5647_event_ctrls_applied {
+	__u32 dirty;	/* OV5647_CTRL_* of each control written */
+	__s32 error;
+};
+
+/*
+ * Frames are counted from 0 at stream on, like the receiver's buffer
+ * sequence.
+ */
+
+/* VIDIOC_OV5647_G_FRAME_META: what a frame was exposed with */
+struct ov5647_frame_meta {
+	__u32 sequence;	/* frame, set by the caller */
+	__u32 exposure;	/* lines */
+	__u32 gain;	/* analogue gain code */
+	__u32 vts;	/* frame length in lines */
+	__u64 timestamp;	/* estimated frame start, CLOCK_MONOTONIC ns */
+};
+
+/* VIDIOC_OV5647_QUEUE_FRAME_CTRLS: values for one future frame */
+struct ov5647_frame_ctrls {
+	__u32 sequence;	/* frame the values are for */
+	__u32 which;	/* OV5647_CTRL_* of each value given */
+	__u32 exposure;	/* lines */
+	__u32 gain;	/* analogue gain code */
+	__u32 vblank;	/* lines */
+};
+
+/* VIDIOC_OV5647_G_CTRL_DELAYS: frames from write to first use */
+struct ov5647_ctrl_delays {
+	__u32 exposure;
+	__u32 gain;
+	__u32 vblank;
+};
+
+#define VIDIOC_OV5647_G_FRAME_META \
+	_IOWR('V', BASE_VIDIOC_PRIVATE + 0, struct ov5647_frame_meta)
+#define VIDIOC_OV5647_QUEUE_FRAME_CTRLS \
+	_IOW('V', BASE_VIDIOC_PRIVATE + 1, struct ov5647_frame_ctrls)
+#define VIDIOC_OV5647_G_CTRL_DELAYS \
+	_IOR('V', BASE_VIDIOC_PRIVATE + 2, struct ov5647_ctrl_delays)
+
+#endif /* __UAPI_OV5647_H__ */
@@ -1,27 +1,49 @@
+#include <linux/build_bug.h>
 #include <linux/clk.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
 #include <linux/gpio/consumer.h>
+#include <linux/hrtimer.h>
 #include <linux/i2c.h>
 #include <linux/init.h>
 #include <linux/io.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
 #include <linux/of_graph.h>
+#include <linux/ov5647.h>
 #include <linux/pm_runtime.h>
 #include <linux/regulator/consumer.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/videodev2.h>
+#include <linux/workqueue.h>
 #include <media/v4l2-ctrls.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-event.h>
 #include <media/v4l2-fwnode.h>
 #include <media/v4l2-mediabus.h>
 #include <media/v4l2-mediabus.h>
+#include <media/v4l2-rect.h>
 #include <asm/unaligned.h>
 
+#define CREATE_TRACE_POINTS
+#include "ov5647_trace.h"
+
 // #define OV5647_REG_VALUE_08BIT		1
 // #define OV5647_REG_VALUE_16BIT		2
 
-#define PWDN_ACTIVE_DELAY_MS	20
+/*
+ * Power-up sequencing: SCCB is usable 1 ms plus 8192 XCLK cycles after the
+ * sensor leaves power down with XCLK running.
+ */
+#define OV5647_PWDN_SCCB_DELAY_US	1000
+#define OV5647_BOOT_XCLK_CYCLES		8192
+
+/*
+ * Idle time in software standby before runtime PM cuts power. Adjustable
+ * through power/autosuspend_delay_ms.
+ */
+#define OV5647_AUTOSUSPEND_DELAY_MS	1000
 
 #define OV5647_SW_STANDBY		0x0100
 #define OV5647_SW_RESET			0x0103
@@ -38,6 +60,43 @@
 /* External clock frequency is 25.0M */
 #define OV5647_XCLK_FREQ		25000000
 
+/*
+ * PLL: pixel rate = XCLK / prediv * multiplier / system divider, with the
+ * MIPI mode of 0x3034 giving 2 pixels per bpp PLL clocks. The pre-divider
+ * is the 0x3037 power-on default, the system divider comes from
+ * 0x3035[7:4] (common to every mode) and the multiplier is per mode. Over
+ * the two data lanes that makes the link frequency independent of bpp.
+ * With a single lane the system divider doubles: the lane keeps its rate
+ * and the pixel rate halves.
+ */
+#define OV5647_REG_PLL_CTRL0		0x3034
+#define OV5647_PLL_CTRL0_MIPI8		0x18
+#define OV5647_PLL_CTRL0_MIPI10		0x1a
+#define OV5647_REG_PLL_CTRL1		0x3035
+#define OV5647_PLL_CTRL1_VAL		0x21
+#define OV5647_PLL_CTRL1_1LANE		0x41
+#define OV5647_REG_PLL_MULT			0x3036
+#define OV5647_PLL_PREDIV			3
+#define OV5647_PLL_SYSDIV			(OV5647_PLL_CTRL1_VAL >> 4)
+#define OV5647_PIXEL_RATE_BPP(mult, bpp) \
+	((uint64_t)OV5647_XCLK_FREQ * (mult) * 2 / \
+	 (OV5647_PLL_PREDIV * OV5647_PLL_SYSDIV * (bpp)))
+#define OV5647_PIXEL_RATE(mult)		OV5647_PIXEL_RATE_BPP(mult, 10)
+#define OV5647_PIXEL_RATE_LANES(mult, bpp, lanes) \
+	(OV5647_PIXEL_RATE_BPP(mult, bpp) * (lanes) / OV5647_MAX_LANES)
+#define OV5647_LINK_FREQ(mult) \
+	((uint64_t)OV5647_XCLK_FREQ * (mult) / \
+	 (OV5647_PLL_PREDIV * OV5647_PLL_SYSDIV * 2))
+
+#define OV5647_REG_HTS_HI		0x380c
+#define OV5647_REG_HTS_LO		0x380d
+/* Shortest line any preset runs the binned readout at */
+#define OV5647_HTS_MIN			1852
+
+/* Frame rate of a generated mode until S_FRAME_INTERVAL asks otherwise */
+#define OV5647_GEN_DEFAULT_FPS		30
+/* Room for a preset table plus the registers the generator computes */
+#define OV5647_GEN_MAX_REGS		64
 #define OV5647_REG_VTS_HI		0x380e
 #define OV5647_REG_VTS_LO		0x380f
 
@@ -60,6 +119,9 @@
 #define OV5647_HOR_MIRROR_EN		0x06
 #define OV5647_HOR_MIRROR_DISABLE	0x00
 
+/* Flip/mirror bits of 0x3820/0x3821; the rest belongs to binning */
+#define OV5647_FLIP_MIRROR_MASK		0x06
+
 /* Image windowing */
 #define OV5647_REG_X_ADDR_START_HIGH 	0x3800
 #define OV5647_REGX_ADDR_START_LOW     	0x3801
@@ -69,6 +131,14 @@
 #define OV5647_REG_X_ADDR_END_LOW       0x3805
 #define OV5647_REG_Y_ADDR_END_HIGH      0x3806
 #define OV5647_REG_Y_ADDR_END_LOW       0x3807
+#define OV5647_REG_X_OUTPUT_SIZE_HIGH	0x3808
+#define OV5647_REG_X_OUTPUT_SIZE_LOW	0x3809
+#define OV5647_REG_Y_OUTPUT_SIZE_HIGH	0x380a
+#define OV5647_REG_Y_OUTPUT_SIZE_LOW	0x380b
+
+/* Subsampling: odd/even pixel increments */
+#define OV5647_REG_X_INC		0x3814
+#define OV5647_REG_Y_INC		0x3815
 
 /* Test Pattern Control */
 #define OV5647_REG_TEST_PATT_TRANS		0x503D
@@ -98,6 +168,38 @@
 
 #define OV5647_VBLANK_MIN		24
 #define OV5647_VTS_MAX			32767
+/* Exposure must stay this many lines short of the frame length */
+#define OV5647_EXPOSURE_MARGIN	4
+
+/* Group hold: buffer register writes and latch them on one frame */
+#define OV5647_REG_GROUP_ACCESS		0x3208
+#define OV5647_GROUP_HOLD_START		0x00
+#define OV5647_GROUP_HOLD_END		0x10
+#define OV5647_GROUP_LAUNCH			0xa0
+/* Frames from a group launch to the first frame exposed with its values */
+#define OV5647_GROUP_DELAY_FRAMES	2
+
+/*
+ * Per-frame metadata. The OV5647 sends no embedded data lines, so there
+ * is no metadata stream; the driver keeps a record of what it programmed
+ * instead. VIDIOC_OV5647_G_FRAME_META on the subdev node is the only way
+ * to read it: it takes a frame sequence number, counted from 0 at stream
+ * on like the receiver's buffers, and returns the struct ov5647_frame_meta
+ * that frame was exposed with.
+ */
+/* Records kept, each covering the frames up to the next one */
+#define OV5647_META_DEPTH		16
+
+/*
+ * Per-frame controls: VIDIOC_OV5647_QUEUE_FRAME_CTRLS queues exposure, gain
+ * and vblank for a future frame of the current stream and the driver writes
+ * them OV5647_GROUP_DELAY_FRAMES ahead of it. VIDIOC_OV5647_G_CTRL_DELAYS
+ * reports that delay for each control.
+ */
+#define OV5647_FRAME_CTRLS_DEPTH	16
+#define OV5647_FRAME_CTRLS_MASK		(OV5647_CTRL_EXPOSURE | \
+					 OV5647_CTRL_GAIN | \
+					 OV5647_CTRL_VBLANK)
 
 /* Analog gain control */
 #define OV564_REG_ANALOG_GAIN1		0x350A
@@ -107,6 +209,10 @@
 #define OV564_ANA_GAIN_STEP			1
 #define OV564_ANA_GAIN_DEFAULT		32
 
+/* Smallest region of interest, in output pixels */
+#define OV5647_ROI_MIN_WIDTH		64
+#define OV5647_ROI_MIN_HEIGHT		16
+
 /* OV5647 native and active pixel array size */
 #define OV5647_NATIVE_WIDTH			2624U
 #define OV5647_NATIVE_HEIGHT		1956U
@@ -117,19 +223,78 @@
 #define OV5647_PIXEL_ARRAY_HEIGHT	1944U
 
 /* MIPI Ctrl*/
+#define OV5647_MAX_LANES			2
+#define OV5647_REG_MIPI_SC_CTRL			0x3018
+#define OV5647_MIPI_SC_CTRL_VAL			0x44
+#define OV5647_MIPI_SC_LANES_MASK		0xe0
+#define OV5647_MIPI_SC_1LANE			0x20
+#define OV5647_MIPI_SC_2LANE			0x40
 #define OV5647_REG_MIPI_FRAME_OFF_NUMBER	0x4202
 #define OV5647_REG_MIPI_CTRL14			0x4814
 #define OV5647_REG_MIPI_AWB				0x5001
 #define OV5647_REG_MIPI_CTRL00			0x4800
 #define OV5647_REG_FRAME_OFF_NUMBER		0x4202
 #define OV5640_REG_PAD_OUT				0x300d
+/* Pixel clock period in ns with one fractional bit */
+#define OV5647_REG_PCLK_PERIOD			0x4837
+
+/* Banding filter: 50Hz/60Hz step in lines and bands per frame */
+#define OV5647_REG_B50_STEP_HI		0x3a08
+#define OV5647_REG_B60_STEP_HI		0x3a0a
+#define OV5647_REG_B60_MAX			0x3a0d
+#define OV5647_REG_B50_MAX			0x3a0e
+/* Band filter on/off, and the 50Hz/60Hz pick when not auto detected */
+#define OV5647_REG_AEC_CTRL00		0x3a00
+#define OV5647_AEC_BAND_EN			BIT(5)
+#define OV5647_REG_5060HZ_CTRL00	0x3c00
+#define OV5647_5060HZ_BAND50		BIT(2)
+#define OV5647_REG_5060HZ_CTRL01	0x3c01
+#define OV5647_5060HZ_MANUAL		BIT(7)
+
+/*
+ * On-sensor AEC: exposure holds while the average luminance is inside the
+ * stable window (WPT/BPT to enter, WPT2/BPT2 to leave) and moves in large
+ * steps while it is outside the fast zone (VPT). AGC stops at the gain
+ * ceiling. The defaults are the values of the common table.
+ */
+#define OV5647_REG_AEC_WPT			0x3a0f
+#define OV5647_REG_AEC_BPT			0x3a10
+#define OV5647_REG_AEC_VPT_HIGH		0x3a11
+#define OV5647_REG_AEC_GAIN_CEIL_HI	0x3a18
+#define OV5647_REG_AEC_GAIN_CEIL_LO	0x3a19
+#define OV5647_REG_AEC_WPT2			0x3a1b
+#define OV5647_REG_AEC_BPT2			0x3a1e
+#define OV5647_REG_AEC_VPT_LOW		0x3a1f
+#define OV5647_AEC_TARGET_DEF		0x54
+#define OV5647_AEC_STABLE_DEF		0x08
+#define OV5647_AEC_FAST_HIGH_DEF	0x60
+#define OV5647_AEC_FAST_LOW_DEF		0x28
+#define OV5647_AGC_CEILING_DEF		0xf8
 
 #define MIPI_CTRL00_CLOCK_LANE_GATE		BIT(5)
 #define MIPI_CTRL00_LINE_SYNC_ENABLE	BIT(4)
 #define MIPI_CTRL00_BUS_IDLE			BIT(2)
 #define MIPI_CTRL00_CLOCK_LANE_DISABLE	BIT(0)
 
-#define OV5647_DEFAULT_LINK_FREQ 297000000
+
+/* Longest auto-increment run sent as one SCCB write (data bytes) */
+#define OV5647_BURST_MAX_LEN	32
+/* Most write messages submitted in one i2c_transfer() call */
+#define OV5647_BATCH_MAX_MSGS	64
+
+/* Register shadow cache window: the sensor control block 0x3000 - 0x5fff */
+#define OV5647_CACHE_BASE		0x3000
+#define OV5647_CACHE_SIZE		0x3000
+
+static bool lazy_detect;
+module_param(lazy_detect, bool, 0444);
+MODULE_PARM_DESC(lazy_detect,
+		 "Leave the sensor powered down at probe and identify it on first use");
+
+static bool async_ctrls;
+module_param(async_ctrls, bool, 0644);
+MODULE_PARM_DESC(async_ctrls,
+		 "Write controls from a worker while streaming so control ioctls do not wait on I2C");
 
 /* regulator supplies */
 static const char * const ov5647_supply_name[] = {
@@ -146,6 +311,48 @@ struct ov5647_reg {
 	uint8_t val;
 };
 
+/*
+ * Members of the control cluster, in the order they sit in struct ov5647.
+ * BIT() of each is the OV5647_CTRL_* userspace sees in dirty and which.
+ */
+enum ov5647_batch_ctrl {
+	OV5647_BATCH_EXPOSURE,
+	OV5647_BATCH_GAIN,
+	OV5647_BATCH_VBLANK,
+	OV5647_BATCH_AUTOGAIN,
+	OV5647_BATCH_EXPOSURE_AUTO,
+	OV5647_BATCH_AWB,
+	OV5647_BATCH_VFLIP,
+	OV5647_BATCH_HFLIP,
+	OV5647_BATCH_NUM,
+};
+
+/* Control values to program; only members flagged in dirty are written */
+struct ov5647_ctrl_batch {
+	unsigned long dirty;
+	s32 val[OV5647_BATCH_NUM];
+};
+
+/* Steps of a cold start, timestamped for the power_timeline debugfs file */
+enum ov5647_power_phase {
+	OV5647_PHASE_REGULATORS,
+	OV5647_PHASE_PWDN,
+	OV5647_PHASE_XCLK,
+	OV5647_PHASE_OE,
+	OV5647_PHASE_MODE,
+	OV5647_PHASE_STREAM,
+	OV5647_PHASE_NUM,
+};
+
+static const char * const ov5647_phase_names[] = {
+	[OV5647_PHASE_REGULATORS]	= "regulators",
+	[OV5647_PHASE_PWDN]		= "pwdn_release",
+	[OV5647_PHASE_XCLK]		= "xclk_stable",
+	[OV5647_PHASE_OE]		= "oe_enable",
+	[OV5647_PHASE_MODE]		= "mode_load",
+	[OV5647_PHASE_STREAM]		= "stream_on",
+};
+
 struct ov5647_reg_list {
 	unsigned int num_of_regs;
 	const struct ov5647_reg *regs;
@@ -169,11 +376,19 @@ struct ov5647_mode {
 	struct v4l2_rect crop;
 
 	uint64_t pixel_rate;
+	uint64_t link_freq;
 
 	/* V-timing */
 	unsigned int vts_def;
 	unsigned int hts_def;
 
+	/*
+	 * Columns/rows the array window reads beyond the output area scaled
+	 * back up by the skip factor; the ISP needs them at the edges.
+	 */
+	unsigned int win_pad_x;
+	unsigned int win_pad_y;
+
 	/* Default register values */
 	struct ov5647_reg_list reg_list;
 
@@ -192,19 +407,72 @@ struct ov5647 {
 	struct gpio_desc *pwr_gpio;
 	struct regulator_bulk_data supplies[OV5647_NUM_SUPPLIES];
 	bool clock_ncont;
+	/* CSI-2 data lanes in use, 1 or 2 */
+	unsigned int lanes;
+	/* Link frequency menu entries the device tree allows */
+	unsigned long link_freq_mask;
 
 	struct v4l2_ctrl_handler ctrl_handler;
 	/* V4L2 Controls */
 	struct v4l2_ctrl *pixel_rate;
 	struct v4l2_ctrl *link_freq;
-	struct v4l2_ctrl *exposure;
-	struct v4l2_ctrl *vflip;
-	struct v4l2_ctrl *hflip;
-	struct v4l2_ctrl *vblank;
+	struct {
+		/*
+		 * Sensor-writable controls, clustered so that one S_EXT_CTRLS
+		 * call reaches the sensor as one register batch. Exposure, gain
+		 * and vblank are applied under one group hold.
+		 */
+		struct v4l2_ctrl *exposure;
+		struct v4l2_ctrl *gain;
+		struct v4l2_ctrl *vblank;
+		struct v4l2_ctrl *autogain;
+		struct v4l2_ctrl *exposure_auto;
+		struct v4l2_ctrl *awb;
+		struct v4l2_ctrl *vflip;
+		struct v4l2_ctrl *hflip;
+	};
 	struct v4l2_ctrl *hblank;
+	struct {
+		/* On-sensor AEC thresholds, written together */
+		struct v4l2_ctrl *aec_target;
+		struct v4l2_ctrl *aec_stable;
+		struct v4l2_ctrl *aec_fast_high;
+		struct v4l2_ctrl *aec_fast_low;
+	};
+
+	/* Deferred control writes, protected by mutex */
+	struct work_struct ctrl_work;
+	struct ov5647_ctrl_batch ctrl_pending;
+	/* Some control values never reached the sensor, protected by mutex */
+	bool ctrls_stale;
+	/* Chip ID checked and register defaults read, protected by mutex */
+	bool detected;
+
+	/* Most recent power on, up to its first stream on */
+	spinlock_t timeline_lock;
+	ktime_t timeline_start;
+	ktime_t timeline[OV5647_PHASE_NUM];
+	struct dentry *debugfs;
 
 	/* Current mode */
 	const struct ov5647_mode *mode;
+	/*
+	 * Active readout: the mode's crop, or a region of interest inside it
+	 * set through set_selection or picked for a scaled format, the output
+	 * size it gives, and the binning and skip factors that get it there.
+	 */
+	struct v4l2_rect crop;
+	unsigned int width;
+	unsigned int height;
+	enum binning_mode binning;
+	unsigned int skip_x;
+	unsigned int skip_y;
+	/* Link frequency menu index the PLL runs at */
+	unsigned int link_idx;
+
+	/* Mode built by ov5647_gen_mode() for a size no preset has */
+	struct ov5647_mode gen_mode;
+	struct ov5647_reg gen_regs[OV5647_GEN_MAX_REGS];
 
     /*
 	 * Mutex for serialized access:
@@ -214,12 +482,70 @@ struct ov5647 {
 
     /* Streaming on/off */
 	bool streaming;
-};
 
-static const struct ov5647_reg  sensor_oe_disable_regs[] = {
-	{0x3000, 0x00},
-	{0x3001, 0x00},
-	{0x3002, 0x00},
+	/*
+	 * Register state per frame of the current or last stream, a ring
+	 * ending at meta_head. Each record holds from its sequence until the
+	 * next one; records for frames not yet started may be replaced.
+	 * Changed under both mutex and frame_lock, read under either.
+	 */
+	struct ov5647_frame_meta meta[OV5647_META_DEPTH];
+	unsigned int meta_head;
+	unsigned int meta_count;
+
+	/*
+	 * Frame timing model while streaming: frame_timer expires at each
+	 * frame start, posting V4L2_EVENT_FRAME_SYNC for it, and at the start
+	 * of its vertical blanking. sync_frame is the next frame to start and
+	 * sync_vblank is set when the blanking of the one before comes first.
+	 * Protected by frame_lock.
+	 */
+	spinlock_t frame_lock;
+	struct hrtimer frame_timer;
+	u32 sync_frame;
+	bool sync_vblank;
+
+	/*
+	 * Control sets queued for frames of the current stream, in frame
+	 * order, protected by mutex. The first one is written from the
+	 * blanking of frame frame_ctrls_issue, through frame_ctrls_work,
+	 * while frame_ctrls_armed; both protected by frame_lock.
+	 */
+	struct work_struct frame_ctrls_work;
+	struct ov5647_frame_ctrls frame_ctrls[OV5647_FRAME_CTRLS_DEPTH];
+	unsigned int num_frame_ctrls;
+	u32 frame_ctrls_issue;
+	bool frame_ctrls_armed;
+
+	/* Data bytes the adapter accepts in one auto-increment write */
+	unsigned int burst_max;
+	/* Write messages the adapter accepts in one i2c_transfer() */
+	unsigned int batch_max;
+
+	/*
+	 * Shadow of the register values last written to (or read from) the
+	 * sensor. Entries are dropped on power off and on software reset.
+	 */
+	uint8_t *reg_cache;
+	unsigned long *reg_cache_valid;
+
+	/* Mode whose table the sensor currently holds, NULL after power loss */
+	const struct ov5647_mode *loaded_mode;
+	/* Link configuration and bit depth the loaded mode was programmed for */
+	unsigned int loaded_link;
+	unsigned int loaded_bpp;
+	/*
+	 * The load patched the pixel rate registers, 0x3a08 among them, which
+	 * only the common init sets and a delta load would not restore.
+	 */
+	bool loaded_patched;
+
+	/*
+	 * Power-on defaults of the registers that only some mode tables
+	 * program, restored on a delta mode switch.
+	 */
+	struct ov5647_reg *reset_regs;
+	unsigned int num_reset_regs;
 };
 
 static const struct ov5647_reg  sensor_oe_enable_regs[] = {
@@ -228,24 +554,185 @@ static const struct ov5647_reg  sensor_oe_enable_regs[] = {
 	{0x3002, 0xe4},
 };
 
+/*
+ * Mode geometry. Every value below lands both in the mode's register table
+ * (through OV5647_GEOMETRY_REGS) and in supported_modes[], and
+ * OV5647_MODE_CHECK verifies them against each other at build time.
+ */
+#define OV5647_2592X1944_WIDTH		2592
+#define OV5647_2592X1944_HEIGHT		1944
+#define OV5647_2592X1944_PLL_MULT	0x69
+#define OV5647_2592X1944_HTS		2844
+#define OV5647_2592X1944_VTS		0x7b0
+#define OV5647_2592X1944_X_START	0
+#define OV5647_2592X1944_Y_START	0
+#define OV5647_2592X1944_X_END		0xa3f
+#define OV5647_2592X1944_Y_END		0x7a3
+#define OV5647_2592X1944_X_INC		0x11
+#define OV5647_2592X1944_Y_INC		0x11
+#define OV5647_2592X1944_BINNING	BINNING_NONE
+#define OV5647_2592X1944_CROP_LEFT	OV5647_PIXEL_ARRAY_LEFT
+#define OV5647_2592X1944_CROP_TOP	OV5647_PIXEL_ARRAY_TOP
+#define OV5647_2592X1944_CROP_WIDTH	OV5647_PIXEL_ARRAY_WIDTH
+#define OV5647_2592X1944_CROP_HEIGHT	OV5647_PIXEL_ARRAY_HEIGHT
+
+#define OV5647_1080P30_WIDTH		1920
+#define OV5647_1080P30_HEIGHT		1080
+#define OV5647_1080P30_PLL_MULT		0x62
+#define OV5647_1080P30_HTS		2416
+#define OV5647_1080P30_VTS		0x450
+#define OV5647_1080P30_X_START		0x15c
+#define OV5647_1080P30_Y_START		0x1b2
+#define OV5647_1080P30_X_END		0x8e3
+#define OV5647_1080P30_Y_END		0x5f1
+#define OV5647_1080P30_X_INC		0x11
+#define OV5647_1080P30_Y_INC		0x11
+#define OV5647_1080P30_BINNING		BINNING_NONE
+#define OV5647_1080P30_CROP_LEFT	(348 + OV5647_PIXEL_ARRAY_LEFT)
+#define OV5647_1080P30_CROP_TOP		(434 + OV5647_PIXEL_ARRAY_TOP)
+#define OV5647_1080P30_CROP_WIDTH	1928
+#define OV5647_1080P30_CROP_HEIGHT	1080
+
+#define OV5647_2X2BINNED_WIDTH		1296
+#define OV5647_2X2BINNED_HEIGHT		972
+#define OV5647_2X2BINNED_PLL_MULT	0x62
+#define OV5647_2X2BINNED_HTS		1896
+#define OV5647_2X2BINNED_VTS		0x59b
+#define OV5647_2X2BINNED_X_START	0
+#define OV5647_2X2BINNED_Y_START	0
+#define OV5647_2X2BINNED_X_END		0xa3f
+#define OV5647_2X2BINNED_Y_END		0x7a3
+#define OV5647_2X2BINNED_X_INC		0x31
+#define OV5647_2X2BINNED_Y_INC		0x31
+#define OV5647_2X2BINNED_BINNING	BINNING_BOTH
+#define OV5647_2X2BINNED_CROP_LEFT	OV5647_PIXEL_ARRAY_LEFT
+#define OV5647_2X2BINNED_CROP_TOP	OV5647_PIXEL_ARRAY_TOP
+#define OV5647_2X2BINNED_CROP_WIDTH	OV5647_PIXEL_ARRAY_WIDTH
+#define OV5647_2X2BINNED_CROP_HEIGHT	OV5647_PIXEL_ARRAY_HEIGHT
+
+#define OV5647_640X480_WIDTH		640
+#define OV5647_640X480_HEIGHT		480
+#define OV5647_640X480_PLL_MULT		0x46
+#define OV5647_640X480_HTS		1852
+#define OV5647_640X480_VTS		0x1f8
+#define OV5647_640X480_X_START		0x10
+#define OV5647_640X480_Y_START		0
+#define OV5647_640X480_X_END		0xa2f
+#define OV5647_640X480_Y_END		0x79f
+#define OV5647_640X480_X_INC		0x35
+#define OV5647_640X480_Y_INC		0x35
+#define OV5647_640X480_BINNING		BINNING_BOTH
+#define OV5647_640X480_CROP_LEFT	(16 + OV5647_PIXEL_ARRAY_LEFT)
+#define OV5647_640X480_CROP_TOP		OV5647_PIXEL_ARRAY_TOP
+#define OV5647_640X480_CROP_WIDTH	2560
+#define OV5647_640X480_CROP_HEIGHT	1920
+
+/* 1296x730: the 2x2 binned readout of a centred 2592x1460 window */
+#define OV5647_1296X730_WIDTH		1296
+#define OV5647_1296X730_HEIGHT		730
+#define OV5647_1296X730_PLL_MULT	0x69
+#define OV5647_1296X730_HTS		1852
+#define OV5647_1296X730_VTS		787
+#define OV5647_1296X730_X_START		0
+#define OV5647_1296X730_Y_START		242
+#define OV5647_1296X730_X_END		0xa3f
+#define OV5647_1296X730_Y_END		1713
+#define OV5647_1296X730_X_INC		0x31
+#define OV5647_1296X730_Y_INC		0x31
+#define OV5647_1296X730_BINNING		BINNING_BOTH
+#define OV5647_1296X730_CROP_LEFT	OV5647_PIXEL_ARRAY_LEFT
+#define OV5647_1296X730_CROP_TOP	(242 + OV5647_PIXEL_ARRAY_TOP)
+#define OV5647_1296X730_CROP_WIDTH	OV5647_PIXEL_ARRAY_WIDTH
+#define OV5647_1296X730_CROP_HEIGHT	1460
+
+/* 640x480 at 90 fps: the VGA readout with the PLL of the full mode */
+#define OV5647_640X480_90_WIDTH		640
+#define OV5647_640X480_90_HEIGHT	480
+#define OV5647_640X480_90_PLL_MULT	0x69
+#define OV5647_640X480_90_HTS		1852
+#define OV5647_640X480_90_VTS		525
+#define OV5647_640X480_90_X_START	OV5647_640X480_X_START
+#define OV5647_640X480_90_Y_START	OV5647_640X480_Y_START
+#define OV5647_640X480_90_X_END		OV5647_640X480_X_END
+#define OV5647_640X480_90_Y_END		OV5647_640X480_Y_END
+#define OV5647_640X480_90_X_INC		OV5647_640X480_X_INC
+#define OV5647_640X480_90_Y_INC		OV5647_640X480_Y_INC
+#define OV5647_640X480_90_BINNING	OV5647_640X480_BINNING
+#define OV5647_640X480_90_CROP_LEFT	OV5647_640X480_CROP_LEFT
+#define OV5647_640X480_90_CROP_TOP	OV5647_640X480_CROP_TOP
+#define OV5647_640X480_90_CROP_WIDTH	OV5647_640X480_CROP_WIDTH
+#define OV5647_640X480_90_CROP_HEIGHT	OV5647_640X480_CROP_HEIGHT
+
+/* 16-bit value split over a high/low register pair */
+#define OV5647_REG16(reg, val)	{ (reg), (val) >> 8 }, { (reg) + 1, (val) & 0xff }
+
+/* Skip factor of an X/Y increment register: (odd inc + even inc) / 2 */
+#define OV5647_SKIP(inc)	((((inc) >> 4) + ((inc) & 0xf)) / 2)
+
+#define OV5647_VER_BIN_VAL(b)	((b) == BINNING_VER || (b) == BINNING_BOTH ? \
+				 OV5647_VER_BINNING_EN : 0x00)
+#define OV5647_HOR_BIN_VAL(b)	((b) == BINNING_HOR || (b) == BINNING_BOTH ? \
+				 OV5647_HOR_BINNING_EN : OV5647_HOR_BINNING_DISABLE)
+
+#define OV5647_WIN_PAD_X(m) \
+	((m##_X_END) - (m##_X_START) + 1 - (m##_WIDTH) * OV5647_SKIP(m##_X_INC))
+#define OV5647_WIN_PAD_Y(m) \
+	((m##_Y_END) - (m##_Y_START) + 1 - (m##_HEIGHT) * OV5647_SKIP(m##_Y_INC))
+
+/*
+ * Window, output size and HTS of a mode. Subsampling and binning are left
+ * to ov5647_write_readout(), which owns 0x3814/0x3815 and shares
+ * 0x3820/0x3821 with the flip controls.
+ */
+#define OV5647_GEOMETRY_REGS(m) \
+	OV5647_REG16(OV5647_REG_X_ADDR_START_HIGH, m##_X_START), \
+	OV5647_REG16(OV5647_REG_Y_ADDR_START_HIGH, m##_Y_START), \
+	OV5647_REG16(OV5647_REG_X_ADDR_END_HIGH, m##_X_END), \
+	OV5647_REG16(OV5647_REG_Y_ADDR_END_HIGH, m##_Y_END), \
+	OV5647_REG16(OV5647_REG_X_OUTPUT_SIZE_HIGH, m##_WIDTH), \
+	OV5647_REG16(OV5647_REG_Y_OUTPUT_SIZE_HIGH, m##_HEIGHT), \
+	OV5647_REG16(OV5647_REG_HTS_HI, m##_HTS)
+
+/*
+ * The window must fit the native array and start where the crop rectangle
+ * says, the crop must fit the window, and the output scaled back up by the
+ * skip factor must fit the crop. HTS/VTS must leave room for blanking.
+ */
+#define OV5647_MODE_CHECK(m) \
+	static_assert(m##_HTS > m##_WIDTH); \
+	static_assert(m##_VTS >= m##_HEIGHT + OV5647_VBLANK_MIN && \
+		      m##_VTS <= OV5647_VTS_MAX); \
+	static_assert(m##_X_END < OV5647_NATIVE_WIDTH && \
+		      m##_Y_END < OV5647_NATIVE_HEIGHT); \
+	static_assert(m##_CROP_LEFT - OV5647_PIXEL_ARRAY_LEFT == m##_X_START && \
+		      m##_CROP_TOP - OV5647_PIXEL_ARRAY_TOP == m##_Y_START); \
+	static_assert(m##_CROP_WIDTH <= m##_X_END - m##_X_START + 1 && \
+		      m##_CROP_HEIGHT <= m##_Y_END - m##_Y_START + 1); \
+	static_assert(m##_WIDTH * OV5647_SKIP(m##_X_INC) <= m##_CROP_WIDTH && \
+		      m##_HEIGHT * OV5647_SKIP(m##_Y_INC) <= m##_CROP_HEIGHT)
+
+OV5647_MODE_CHECK(OV5647_2592X1944);
+OV5647_MODE_CHECK(OV5647_1080P30);
+OV5647_MODE_CHECK(OV5647_2X2BINNED);
+OV5647_MODE_CHECK(OV5647_640X480);
+OV5647_MODE_CHECK(OV5647_1296X730);
+OV5647_MODE_CHECK(OV5647_640X480_90);
+
 // modes 
-// 2592 x 1944 15fps
-static struct ov5647_reg ov5647_2592x1944_10bpp[] = {
+/*
+ * Common init shared by every mode. Written once per power-on, the per-mode
+ * tables below then only carry what differs between modes.
+ */
+static const struct ov5647_reg ov5647_common_regs[] = {
 	{0x0100, 0x00},
 	{0x0103, 0x01},
-	{0x3034, 0x1a},
-	{0x3035, 0x21},
-	{0x3036, 0x69},
+	{OV5647_REG_PLL_CTRL0, OV5647_PLL_CTRL0_MIPI10},
+	{OV5647_REG_PLL_CTRL1, OV5647_PLL_CTRL1_VAL},
 	{0x303c, 0x11},
 	{0x3106, 0xf5},
-	{0x3821, 0x00},
-	{0x3820, 0x00},
 	{0x3827, 0xec},
 	{0x370c, 0x03},
-	{0x3612, 0x5b},
-	{0x3618, 0x04},
 	{0x5000, 0x06},
-	{0x5002, 0x41},
 	{0x5003, 0x08},
 	{0x5a00, 0x08},
 	{0x3000, 0x00},
@@ -253,33 +740,13 @@ static struct ov5647_reg ov5647_2592x1944_10bpp[] = {
 	{0x3002, 0x00},
 	{0x3016, 0x08},
 	{0x3017, 0xe0},
-	{0x3018, 0x44},
+	{OV5647_REG_MIPI_SC_CTRL, OV5647_MIPI_SC_CTRL_VAL},
 	{0x301c, 0xf8},
 	{0x301d, 0xf0},
-	{0x3a18, 0x00},
-	{0x3a19, 0xf8},
+	{OV5647_REG_AEC_GAIN_CEIL_HI, OV5647_AGC_CEILING_DEF >> 8},
+	{OV5647_REG_AEC_GAIN_CEIL_LO, OV5647_AGC_CEILING_DEF & 0xff},
 	{0x3c01, 0x80},
 	{0x3b07, 0x0c},
-	{0x380c, 0x0b},
-	{0x380d, 0x1c},
-	{0x3814, 0x11},
-	{0x3815, 0x11},
-	{0x3708, 0x64},
-	{0x3709, 0x12},
-	{0x3808, 0x0a},
-	{0x3809, 0x20},
-	{0x380a, 0x07},
-	{0x380b, 0x98},
-	{0x3800, 0x00},
-	{0x3801, 0x00},
-	{0x3802, 0x00},
-	{0x3803, 0x00},
-	{0x3804, 0x0a},
-	{0x3805, 0x3f},
-	{0x3806, 0x07},
-	{0x3807, 0xa3},
-	{0x3811, 0x10},
-	{0x3813, 0x06},
 	{0x3630, 0x2e},
 	{0x3632, 0xe2},
 	{0x3633, 0x23},
@@ -299,389 +766,402 @@ static struct ov5647_reg ov5647_2592x1944_10bpp[] = {
 	{0x3f06, 0x10},
 	{0x3f01, 0x0a},
 	{0x3a08, 0x01},
+	{OV5647_REG_AEC_WPT, OV5647_AEC_TARGET_DEF + OV5647_AEC_STABLE_DEF / 2},
+	{OV5647_REG_AEC_BPT, OV5647_AEC_TARGET_DEF - OV5647_AEC_STABLE_DEF / 2},
+	{OV5647_REG_AEC_WPT2, OV5647_AEC_TARGET_DEF + OV5647_AEC_STABLE_DEF / 2},
+	{OV5647_REG_AEC_BPT2, OV5647_AEC_TARGET_DEF - OV5647_AEC_STABLE_DEF / 2},
+	{OV5647_REG_AEC_VPT_HIGH, OV5647_AEC_FAST_HIGH_DEF},
+	{OV5647_REG_AEC_VPT_LOW, OV5647_AEC_FAST_LOW_DEF},
+	{0x4001, 0x02},
+	{0x4000, 0x09},
+	{0x3503, 0x03},
+};
+
+// 2592 x 1944 15fps
+static const struct ov5647_reg ov5647_2592x1944_10bpp[] = {
+	{OV5647_REG_PLL_MULT, OV5647_2592X1944_PLL_MULT},
+	OV5647_GEOMETRY_REGS(OV5647_2592X1944),
+	{0x3612, 0x5b},
+	{0x3618, 0x04},
+	{0x5002, 0x41},
+	{0x3708, 0x64},
+	{0x3709, 0x12},
+	{0x3811, 0x10},
+	{0x3813, 0x06},
 	{0x3a09, 0x28},
 	{0x3a0a, 0x00},
 	{0x3a0b, 0xf6},
 	{0x3a0d, 0x08},
 	{0x3a0e, 0x06},
-	{0x3a0f, 0x58},
-	{0x3a10, 0x50},
-	{0x3a1b, 0x58},
-	{0x3a1e, 0x50},
-	{0x3a11, 0x60},
-	{0x3a1f, 0x28},
-	{0x4001, 0x02},
 	{0x4004, 0x04},
-	{0x4000, 0x09},
 	{0x4837, 0x19},
 	{0x4800, 0x24},
-	{0x3503, 0x03},
-	{0x0100, 0x01},
 };
 
 // 1080p 30fps
-static struct ov5647_reg ov5647_1080p30_10bpp[] = {
-	{0x0100, 0x00},
-	{0x0103, 0x01},
-	{0x3034, 0x1a},
-	{0x3035, 0x21},
-	{0x3036, 0x62},
-	{0x303c, 0x11},
-	{0x3106, 0xf5},
-	{0x3821, 0x00},
-	{0x3820, 0x00},
-	{0x3827, 0xec},
-	{0x370c, 0x03},
+static const struct ov5647_reg ov5647_1080p30_10bpp[] = {
+	{OV5647_REG_PLL_MULT, OV5647_1080P30_PLL_MULT},
+	OV5647_GEOMETRY_REGS(OV5647_1080P30),
 	{0x3612, 0x5b},
 	{0x3618, 0x04},
-	{0x5000, 0x06},
 	{0x5002, 0x41},
-	{0x5003, 0x08},
-	{0x5a00, 0x08},
-	{0x3000, 0x00},
-	{0x3001, 0x00},
-	{0x3002, 0x00},
-	{0x3016, 0x08},
-	{0x3017, 0xe0},
-	{0x3018, 0x44},
-	{0x301c, 0xf8},
-	{0x301d, 0xf0},
-	{0x3a18, 0x00},
-	{0x3a19, 0xf8},
-	{0x3c01, 0x80},
-	{0x3b07, 0x0c},
-	{0x380c, 0x09},
-	{0x380d, 0x70},
-	{0x3814, 0x11},
-	{0x3815, 0x11},
 	{0x3708, 0x64},
 	{0x3709, 0x12},
-	{0x3808, 0x07},
-	{0x3809, 0x80},
-	{0x380a, 0x04},
-	{0x380b, 0x38},
-	{0x3800, 0x01},
-	{0x3801, 0x5c},
-	{0x3802, 0x01},
-	{0x3803, 0xb2},
-	{0x3804, 0x08},
-	{0x3805, 0xe3},
-	{0x3806, 0x05},
-	{0x3807, 0xf1},
 	{0x3811, 0x04},
 	{0x3813, 0x02},
-	{0x3630, 0x2e},
-	{0x3632, 0xe2},
-	{0x3633, 0x23},
-	{0x3634, 0x44},
-	{0x3636, 0x06},
-	{0x3620, 0x64},
-	{0x3621, 0xe0},
-	{0x3600, 0x37},
-	{0x3704, 0xa0},
-	{0x3703, 0x5a},
-	{0x3715, 0x78},
-	{0x3717, 0x01},
-	{0x3731, 0x02},
-	{0x370b, 0x60},
-	{0x3705, 0x1a},
-	{0x3f05, 0x02},
-	{0x3f06, 0x10},
-	{0x3f01, 0x0a},
-	{0x3a08, 0x01},
 	{0x3a09, 0x4b},
 	{0x3a0a, 0x01},
 	{0x3a0b, 0x13},
 	{0x3a0d, 0x04},
 	{0x3a0e, 0x03},
-	{0x3a0f, 0x58},
-	{0x3a10, 0x50},
-	{0x3a1b, 0x58},
-	{0x3a1e, 0x50},
-	{0x3a11, 0x60},
-	{0x3a1f, 0x28},
-	{0x4001, 0x02},
 	{0x4004, 0x04},
-	{0x4000, 0x09},
 	{0x4837, 0x19},
 	{0x4800, 0x34},
-	{0x3503, 0x03},
-	{0x0100, 0x01},
 };
 
-static struct ov5647_reg ov5647_2x2binned_10bpp[] = {
-	{0x0100, 0x00},
-	{0x0103, 0x01},
-	{0x3034, 0x1a},
-	{0x3035, 0x21},
-	{0x3036, 0x62},
-	{0x303c, 0x11},
-	{0x3106, 0xf5},
-	{0x3827, 0xec},
-	{0x370c, 0x03},
+// 1296 x 972 2x2 binned
+static const struct ov5647_reg ov5647_2x2binned_10bpp[] = {
+	{OV5647_REG_PLL_MULT, OV5647_2X2BINNED_PLL_MULT},
+	OV5647_GEOMETRY_REGS(OV5647_2X2BINNED),
 	{0x3612, 0x59},
 	{0x3618, 0x00},
-	{0x5000, 0x06},
 	{0x5002, 0x41},
-	{0x5003, 0x08},
-	{0x5a00, 0x08},
-	{0x3000, 0x00},
-	{0x3001, 0x00},
-	{0x3002, 0x00},
-	{0x3016, 0x08},
-	{0x3017, 0xe0},
-	{0x3018, 0x44},
-	{0x301c, 0xf8},
-	{0x301d, 0xf0},
-	{0x3a18, 0x00},
-	{0x3a19, 0xf8},
-	{0x3c01, 0x80},
-	{0x3b07, 0x0c},
-	{0x3800, 0x00},
-	{0x3801, 0x00},
-	{0x3802, 0x00},
-	{0x3803, 0x00},
-	{0x3804, 0x0a},
-	{0x3805, 0x3f},
-	{0x3806, 0x07},
-	{0x3807, 0xa3},
-	{0x3808, 0x05},
-	{0x3809, 0x10},
-	{0x380a, 0x03},
-	{0x380b, 0xcc},
-	{0x380c, 0x07},
-	{0x380d, 0x68},
 	{0x3811, 0x0c},
 	{0x3813, 0x06},
-	{0x3814, 0x31},
-	{0x3815, 0x31},
-	{0x3630, 0x2e},
-	{0x3632, 0xe2},
-	{0x3633, 0x23},
-	{0x3634, 0x44},
-	{0x3636, 0x06},
-	{0x3620, 0x64},
-	{0x3621, 0xe0},
-	{0x3600, 0x37},
-	{0x3704, 0xa0},
-	{0x3703, 0x5a},
-	{0x3715, 0x78},
-	{0x3717, 0x01},
-	{0x3731, 0x02},
-	{0x370b, 0x60},
-	{0x3705, 0x1a},
-	{0x3f05, 0x02},
-	{0x3f06, 0x10},
-	{0x3f01, 0x0a},
-	{0x3a08, 0x01},
 	{0x3a09, 0x28},
 	{0x3a0a, 0x00},
 	{0x3a0b, 0xf6},
 	{0x3a0d, 0x08},
 	{0x3a0e, 0x06},
-	{0x3a0f, 0x58},
-	{0x3a10, 0x50},
-	{0x3a1b, 0x58},
-	{0x3a1e, 0x50},
-	{0x3a11, 0x60},
-	{0x3a1f, 0x28},
-	{0x4001, 0x02},
 	{0x4004, 0x04},
-	{0x4000, 0x09},
 	{0x4837, 0x16},
 	{0x4800, 0x24},
-	{0x3503, 0x03},
-	{0x3820, 0x41},
-	{0x3821, 0x01},
 	{0x350a, 0x00},
 	{0x350b, 0x10},
 	{0x3500, 0x00},
 	{0x3501, 0x1a},
 	{0x3502, 0xf0},
 	{0x3212, 0xa0},
-	{0x0100, 0x01},
 };
 
-static struct ov5647_reg ov5647_640x480_10bpp[] = {
-	{0x0100, 0x00},
-	{0x0103, 0x01},
-	{0x3035, 0x11},
-	{0x3036, 0x46},
-	{0x303c, 0x11},
-	{0x3821, 0x01},
-	{0x3820, 0x41},
-	{0x370c, 0x03},
+// 640 x 480 2x2 binned and subsampled
+static const struct ov5647_reg ov5647_640x480_10bpp[] = {
+	{OV5647_REG_PLL_MULT, OV5647_640X480_PLL_MULT},
+	OV5647_GEOMETRY_REGS(OV5647_640X480),
 	{0x3612, 0x59},
 	{0x3618, 0x00},
-	{0x5000, 0x06},
-	{0x5003, 0x08},
-	{0x5a00, 0x08},
-	{0x3000, 0xff},
-	{0x3001, 0xff},
-	{0x3002, 0xff},
-	{0x301d, 0xf0},
-	{0x3a18, 0x00},
-	{0x3a19, 0xf8},
-	{0x3c01, 0x80},
-	{0x3b07, 0x0c},
-	{0x380c, 0x07},
-	{0x380d, 0x3c},
-	{0x3814, 0x35},
-	{0x3815, 0x35},
 	{0x3708, 0x64},
 	{0x3709, 0x52},
-	{0x3808, 0x02},
-	{0x3809, 0x80},
-	{0x380a, 0x01},
-	{0x380b, 0xe0},
-	{0x3800, 0x00},
-	{0x3801, 0x10},
-	{0x3802, 0x00},
-	{0x3803, 0x00},
-	{0x3804, 0x0a},
-	{0x3805, 0x2f},
-	{0x3806, 0x07},
-	{0x3807, 0x9f},
-	{0x3630, 0x2e},
-	{0x3632, 0xe2},
-	{0x3633, 0x23},
-	{0x3634, 0x44},
-	{0x3620, 0x64},
-	{0x3621, 0xe0},
-	{0x3600, 0x37},
-	{0x3704, 0xa0},
-	{0x3703, 0x5a},
-	{0x3715, 0x78},
-	{0x3717, 0x01},
-	{0x3731, 0x02},
-	{0x370b, 0x60},
-	{0x3705, 0x1a},
-	{0x3f05, 0x02},
-	{0x3f06, 0x10},
-	{0x3f01, 0x0a},
-	{0x3a08, 0x01},
 	{0x3a09, 0x2e},
 	{0x3a0a, 0x00},
 	{0x3a0b, 0xfb},
 	{0x3a0d, 0x02},
 	{0x3a0e, 0x01},
-	{0x3a0f, 0x58},
-	{0x3a10, 0x50},
-	{0x3a1b, 0x58},
-	{0x3a1e, 0x50},
-	{0x3a11, 0x60},
-	{0x3a1f, 0x28},
-	{0x4001, 0x02},
 	{0x4004, 0x02},
-	{0x4000, 0x09},
-	{0x3000, 0x00},
-	{0x3001, 0x00},
-	{0x3002, 0x00},
-	{0x3017, 0xe0},
-	{0x301c, 0xfc},
-	{0x3636, 0x06},
-	{0x3016, 0x08},
-	{0x3827, 0xec},
-	{0x3018, 0x44},
-	{0x3035, 0x21},
-	{0x3106, 0xf5},
-	{0x3034, 0x1a},
-	{0x301c, 0xf8},
 	{0x4800, 0x34},
-	{0x3503, 0x03},
-	{0x0100, 0x01},
+};
+
+/*
+ * 1296 x 730 2x2 binned, 60fps. At 87.5M / 1852 a line takes 21.2us, so
+ * the 50Hz/60Hz banding steps are 472 (0x1d8) and 394 (0x18a) lines.
+ */
+static const struct ov5647_reg ov5647_1296x730_10bpp[] = {
+	{OV5647_REG_PLL_MULT, OV5647_1296X730_PLL_MULT},
+	OV5647_GEOMETRY_REGS(OV5647_1296X730),
+	{0x3612, 0x59},
+	{0x3618, 0x00},
+	{0x5002, 0x41},
+	{0x3811, 0x0c},
+	{0x3813, 0x06},
+	{0x3a09, 0xd8},
+	{0x3a0a, 0x01},
+	{0x3a0b, 0x8a},
+	{0x3a0d, 0x01},
+	{0x3a0e, 0x01},
+	{0x4004, 0x04},
+	{0x4837, 0x19},
+	{0x4800, 0x24},
+};
+
+/* 640 x 480 2x2 binned and subsampled, 90fps. Same line time as 1296x730. */
+static const struct ov5647_reg ov5647_640x480_90fps_10bpp[] = {
+	{OV5647_REG_PLL_MULT, OV5647_640X480_90_PLL_MULT},
+	OV5647_GEOMETRY_REGS(OV5647_640X480_90),
+	{0x3612, 0x59},
+	{0x3618, 0x00},
+	{0x3708, 0x64},
+	{0x3709, 0x52},
+	{0x3a09, 0xd8},
+	{0x3a0a, 0x01},
+	{0x3a0b, 0x8a},
+	{0x3a0d, 0x01},
+	{0x3a0e, 0x01},
+	{0x4004, 0x02},
+	{0x4837, 0x19},
+	{0x4800, 0x34},
+};
+
+/*
+ * Link frequency configurations, slowest first: the PLL multipliers the
+ * presets run at plus one in between. V4L2_CID_LINK_FREQ indexes both.
+ */
+static const uint8_t ov5647_link_pll_mult[] = {
+	0x46, 0x54, 0x62, 0x69,
+};
+
+/*
+ * MIPI clock period (0x4837) at each link frequency for 10 bits on two
+ * lanes: the values of the 1080p and 2592x1944 presets, and scaled from
+ * 0x69's, rounded up, for the two the presets do not use.
+ */
+static const uint8_t ov5647_link_pclk_period[] = {
+	0x26, 0x20, 0x19, 0x19,
 };
 
 static const int64_t ov5647_link_freq_menu[] = {
-	OV5647_DEFAULT_LINK_FREQ,
+	OV5647_LINK_FREQ(0x46),
+	OV5647_LINK_FREQ(0x54),
+	OV5647_LINK_FREQ(0x62),
+	OV5647_LINK_FREQ(0x69),
+};
+static_assert(ARRAY_SIZE(ov5647_link_pll_mult) ==
+	      ARRAY_SIZE(ov5647_link_freq_menu));
+static_assert(ARRAY_SIZE(ov5647_link_pll_mult) ==
+	      ARRAY_SIZE(ov5647_link_pclk_period));
+
+/*
+ * Image pad bus formats, the default first. RAW8 switches the MIPI bit
+ * mode in 0x3034; at the same link frequency that is 10/8 the pixel rate.
+ */
+static const u32 ov5647_mbus_codes[] = {
+	MEDIA_BUS_FMT_SBGGR10_1X10,
+	MEDIA_BUS_FMT_SBGGR8_1X8,
 };
 
+static unsigned int ov5647_code_bpp(u32 code)
+{
+	return code == MEDIA_BUS_FMT_SBGGR8_1X8 ? 8 : 10;
+}
+
+static bool ov5647_code_supported(u32 code)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(ov5647_mbus_codes); i++)
+		if (ov5647_mbus_codes[i] == code)
+			return true;
+
+	return false;
+}
+
 /* Mode configs */
 static const struct ov5647_mode supported_modes[] = {
 	/* 2592x1944 full resolution full FOV 10-bit mode. */
 	{
-		.width 		= 2592,
-		.height 	= 1944,
+		.width		= OV5647_2592X1944_WIDTH,
+		.height		= OV5647_2592X1944_HEIGHT,
 		.crop = {
-			.left		= OV5647_PIXEL_ARRAY_LEFT,
-			.top		= OV5647_PIXEL_ARRAY_TOP,
-			.width		= OV5647_PIXEL_ARRAY_WIDTH,
-			.height		= OV5647_PIXEL_ARRAY_HEIGHT
+			.left		= OV5647_2592X1944_CROP_LEFT,
+			.top		= OV5647_2592X1944_CROP_TOP,
+			.width		= OV5647_2592X1944_CROP_WIDTH,
+			.height		= OV5647_2592X1944_CROP_HEIGHT,
 		},
-		.pixel_rate	= 87500000,
-		.hts_def		= 2844,
-		.vts_def		= 0x7b0,
+		.pixel_rate	= OV5647_PIXEL_RATE(OV5647_2592X1944_PLL_MULT),
+		.link_freq	= OV5647_LINK_FREQ(OV5647_2592X1944_PLL_MULT),
+		.hts_def		= OV5647_2592X1944_HTS,
+		.vts_def		= OV5647_2592X1944_VTS,
+		.win_pad_x	= OV5647_WIN_PAD_X(OV5647_2592X1944),
+		.win_pad_y	= OV5647_WIN_PAD_Y(OV5647_2592X1944),
 		.reg_list = {
 			.num_of_regs = ARRAY_SIZE(ov5647_2592x1944_10bpp),
 			.regs = ov5647_2592x1944_10bpp,
 		},
-		.binning = BINNING_NONE
+		.binning = OV5647_2592X1944_BINNING
 	},
 	/* 1080p30 10-bit mode. Full resolution centre-cropped down to 1080p. */
 	{
-		.width		= 1920,
-		.height		= 1080,
+		.width		= OV5647_1080P30_WIDTH,
+		.height		= OV5647_1080P30_HEIGHT,
 		.crop = {
-			.left		= 348 + OV5647_PIXEL_ARRAY_LEFT,
-			.top		= 434 + OV5647_PIXEL_ARRAY_TOP,
-			.width		= 1928,
-			.height		= 1080,
+			.left		= OV5647_1080P30_CROP_LEFT,
+			.top		= OV5647_1080P30_CROP_TOP,
+			.width		= OV5647_1080P30_CROP_WIDTH,
+			.height		= OV5647_1080P30_CROP_HEIGHT,
 		},
-		.pixel_rate	= 81666700,
-		.hts_def		= 2416,
-		.vts_def		= 0x450,
+		.pixel_rate	= OV5647_PIXEL_RATE(OV5647_1080P30_PLL_MULT),
+		.link_freq	= OV5647_LINK_FREQ(OV5647_1080P30_PLL_MULT),
+		.hts_def		= OV5647_1080P30_HTS,
+		.vts_def		= OV5647_1080P30_VTS,
+		.win_pad_x	= OV5647_WIN_PAD_X(OV5647_1080P30),
+		.win_pad_y	= OV5647_WIN_PAD_Y(OV5647_1080P30),
 		.reg_list = {
 			.num_of_regs = ARRAY_SIZE(ov5647_1080p30_10bpp),
 			.regs = ov5647_1080p30_10bpp,
 		},
-		.binning = BINNING_NONE
-	}, 
+		.binning = OV5647_1080P30_BINNING
+	},
 	/* 2x2 binned full FOV 10-bit mode. */
 	{
-		.width		= 1296,
-		.height		= 972,
+		.width		= OV5647_2X2BINNED_WIDTH,
+		.height		= OV5647_2X2BINNED_HEIGHT,
 		.crop = {
-			.left		= OV5647_PIXEL_ARRAY_LEFT,
-			.top		= OV5647_PIXEL_ARRAY_TOP,
-			.width		= OV5647_PIXEL_ARRAY_WIDTH,
-			.height		= OV5647_PIXEL_ARRAY_HEIGHT
+			.left		= OV5647_2X2BINNED_CROP_LEFT,
+			.top		= OV5647_2X2BINNED_CROP_TOP,
+			.width		= OV5647_2X2BINNED_CROP_WIDTH,
+			.height		= OV5647_2X2BINNED_CROP_HEIGHT,
 		},
-		.pixel_rate	= 81666700,
-		.hts_def		= 1896,
-		.vts_def		= 0x59b,
+		.pixel_rate	= OV5647_PIXEL_RATE(OV5647_2X2BINNED_PLL_MULT),
+		.link_freq	= OV5647_LINK_FREQ(OV5647_2X2BINNED_PLL_MULT),
+		.hts_def		= OV5647_2X2BINNED_HTS,
+		.vts_def		= OV5647_2X2BINNED_VTS,
+		.win_pad_x	= OV5647_WIN_PAD_X(OV5647_2X2BINNED),
+		.win_pad_y	= OV5647_WIN_PAD_Y(OV5647_2X2BINNED),
 		.reg_list = {
 			.num_of_regs = ARRAY_SIZE(ov5647_2x2binned_10bpp),
 			.regs = ov5647_2x2binned_10bpp,
 		},
-		.binning = BINNING_BOTH
+		.binning = OV5647_2X2BINNED_BINNING
 	},
 	/* 10-bit VGA full FOV 60fps. 2x2 binned and subsampled down to VGA. */
 	{
-		.width		= 640,
-		.height		= 480,
+		.width		= OV5647_640X480_WIDTH,
+		.height		= OV5647_640X480_HEIGHT,
 		.crop = {
-			.left		= 16 + OV5647_PIXEL_ARRAY_LEFT,
-			.top		= OV5647_PIXEL_ARRAY_TOP,
-			.width		= 2560,
-			.height		= 1920,
+			.left		= OV5647_640X480_CROP_LEFT,
+			.top		= OV5647_640X480_CROP_TOP,
+			.width		= OV5647_640X480_CROP_WIDTH,
+			.height		= OV5647_640X480_CROP_HEIGHT,
 		},
-		.pixel_rate	= 55000000,
-		.hts_def		= 1852,
-		.vts_def		= 0x1f8,
+		.pixel_rate	= OV5647_PIXEL_RATE(OV5647_640X480_PLL_MULT),
+		.link_freq	= OV5647_LINK_FREQ(OV5647_640X480_PLL_MULT),
+		.hts_def		= OV5647_640X480_HTS,
+		.vts_def		= OV5647_640X480_VTS,
+		.win_pad_x	= OV5647_WIN_PAD_X(OV5647_640X480),
+		.win_pad_y	= OV5647_WIN_PAD_Y(OV5647_640X480),
 		.reg_list = {
 			.num_of_regs = ARRAY_SIZE(ov5647_640x480_10bpp),
 			.regs = ov5647_640x480_10bpp,
 		},
-		.binning = BINNING_NONE
+		.binning = OV5647_640X480_BINNING
+	},
+	/* 1296x730 60fps 10-bit. 2x2 binned, centre-cropped to 16:9. */
+	{
+		.width		= OV5647_1296X730_WIDTH,
+		.height		= OV5647_1296X730_HEIGHT,
+		.crop = {
+			.left		= OV5647_1296X730_CROP_LEFT,
+			.top		= OV5647_1296X730_CROP_TOP,
+			.width		= OV5647_1296X730_CROP_WIDTH,
+			.height		= OV5647_1296X730_CROP_HEIGHT,
+		},
+		.pixel_rate	= OV5647_PIXEL_RATE(OV5647_1296X730_PLL_MULT),
+		.link_freq	= OV5647_LINK_FREQ(OV5647_1296X730_PLL_MULT),
+		.hts_def		= OV5647_1296X730_HTS,
+		.vts_def		= OV5647_1296X730_VTS,
+		.win_pad_x	= OV5647_WIN_PAD_X(OV5647_1296X730),
+		.win_pad_y	= OV5647_WIN_PAD_Y(OV5647_1296X730),
+		.reg_list = {
+			.num_of_regs = ARRAY_SIZE(ov5647_1296x730_10bpp),
+			.regs = ov5647_1296x730_10bpp,
+		},
+		.binning = OV5647_1296X730_BINNING
+	},
+	/*
+	 * 10-bit VGA full FOV 90fps. Same size as the 60fps VGA mode, picked
+	 * by S_FRAME_INTERVAL when that one cannot run fast enough.
+	 */
+	{
+		.width		= OV5647_640X480_90_WIDTH,
+		.height		= OV5647_640X480_90_HEIGHT,
+		.crop = {
+			.left		= OV5647_640X480_90_CROP_LEFT,
+			.top		= OV5647_640X480_90_CROP_TOP,
+			.width		= OV5647_640X480_90_CROP_WIDTH,
+			.height		= OV5647_640X480_90_CROP_HEIGHT,
+		},
+		.pixel_rate	= OV5647_PIXEL_RATE(OV5647_640X480_90_PLL_MULT),
+		.link_freq	= OV5647_LINK_FREQ(OV5647_640X480_90_PLL_MULT),
+		.hts_def		= OV5647_640X480_90_HTS,
+		.vts_def		= OV5647_640X480_90_VTS,
+		.win_pad_x	= OV5647_WIN_PAD_X(OV5647_640X480_90),
+		.win_pad_y	= OV5647_WIN_PAD_Y(OV5647_640X480_90),
+		.reg_list = {
+			.num_of_regs = ARRAY_SIZE(ov5647_640x480_90fps_10bpp),
+			.regs = ov5647_640x480_90fps_10bpp,
+		},
+		.binning = OV5647_640X480_90_BINNING
 	}
 };
 
-static int ov5647_read_reg_8bit(struct ov5647 *ov5647, uint16_t reg, uint8_t *val)
+/*
+ * Registers that are never served from the shadow cache: anything outside
+ * the cache window (standby, software reset), the chip ID, the group access
+ * command register, and the exposure and gain registers which the on-chip
+ * AEC/AGC updates by itself.
+ */
+static bool ov5647_reg_volatile(uint16_t reg)
 {
-	struct i2c_client *client = v4l2_get_subdevdata(&ov5647->sd);
-	struct i2c_msg msgs[2];
-	uint8_t addr_buf[2] = { reg >> 8, reg & 0xff };
-	int ret;
+	if (reg < OV5647_CACHE_BASE ||
+	    reg >= OV5647_CACHE_BASE + OV5647_CACHE_SIZE)
+		return true;
+
+	switch (reg) {
+		case OV5647_REG_CHIP_ID_HIGH:
+		case OV5647_REG_CHIP_ID_LOW:
+		case OV5647_REG_GROUP_ACCESS:
+		case OV5647_REG_EXPOSURE2 ... OV5647_REG_EXPOSURE0:
+		case OV5647_REG_GAIN_HI ... OV5647_REG_GAIN_LO:
+			return true;
+	}
+
+	return false;
+}
+
+static void ov5647_cache_invalidate(struct ov5647 *ov5647)
+{
+	bitmap_zero(ov5647->reg_cache_valid, OV5647_CACHE_SIZE);
+}
+
+static bool ov5647_cache_get(struct ov5647 *ov5647, uint16_t reg, uint8_t *val)
+{
+	if (ov5647_reg_volatile(reg) ||
+	    !test_bit(reg - OV5647_CACHE_BASE, ov5647->reg_cache_valid))
+		return false;
+
+	*val = ov5647->reg_cache[reg - OV5647_CACHE_BASE];
+	return true;
+}
+
+static void ov5647_cache_set(struct ov5647 *ov5647, uint16_t reg, uint8_t val)
+{
+	if (reg == OV5647_SW_RESET) {
+		/* Every register is back at its power-on default */
+		ov5647_cache_invalidate(ov5647);
+		return;
+	}
+
+	if (ov5647_reg_volatile(reg))
+		return;
+
+	ov5647->reg_cache[reg - OV5647_CACHE_BASE] = val;
+	__set_bit(reg - OV5647_CACHE_BASE, ov5647->reg_cache_valid);
+}
+
+/* True when the sensor is known to already hold val in reg */
+static bool ov5647_cache_match(struct ov5647 *ov5647, uint16_t reg, uint8_t val)
+{
+	uint8_t cached;
+
+	return ov5647_cache_get(ov5647, reg, &cached) && cached == val;
+}
+
+static int ov5647_read_reg_8bit(struct ov5647 *ov5647, uint16_t reg, uint8_t *val)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(&ov5647->sd);
+	struct i2c_msg msgs[2];
+	uint8_t addr_buf[2] = { reg >> 8, reg & 0xff };
+	ktime_t start;
+	int ret;
 
 	/* Write register address */
 	msgs[0].addr = client->addr;
@@ -695,9 +1175,18 @@ static int ov5647_read_reg_8bit(struct ov5647 *ov5647, uint16_t reg, uint8_t *va
 	msgs[1].len = 1;
 	msgs[1].buf = val;
 
+	if (ov5647_cache_get(ov5647, reg, val))
+		return 0;
+
+	start = ktime_get();
 	ret = i2c_transfer(client->adapter, msgs, ARRAY_SIZE(msgs));
-	if (ret != ARRAY_SIZE(msgs))
-		return -EIO;
+	ret = ret == ARRAY_SIZE(msgs) ? 0 : -EIO;
+	trace_ov5647_reg_read(reg, ret ? 0 : *val,
+			      ktime_to_ns(ktime_sub(ktime_get(), start)), ret);
+	if (ret)
+		return ret;
+
+	ov5647_cache_set(ov5647, reg, *val);
 	return 0;
 }
 
@@ -705,10 +1194,80 @@ static int ov5647_write_reg_8bit(struct ov5647 *ov5647, uint16_t reg, uint8_t va
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&ov5647->sd);
 	uint8_t buf[3] = { reg >> 8, reg & 0xff, val};;
+	ktime_t start;
+	int ret;
 
-	if (i2c_master_send(client, buf, 3) != 3) {
-		printk("error in write reg 8 bit");
-		return -EINVAL;
+	if (ov5647_cache_match(ov5647, reg, val))
+		return 0;
+
+	start = ktime_get();
+	ret = i2c_master_send(client, buf, 3) == 3 ? 0 : -EINVAL;
+	trace_ov5647_reg_write(reg, val,
+			       ktime_to_ns(ktime_sub(ktime_get(), start)), ret);
+	if (ret) {
+		ov5647_cache_invalidate(ov5647);
+		return ret;
+	}
+
+	ov5647_cache_set(ov5647, reg, val);
+	return 0;
+}
+
+/* Read-modify-write, served from the shadow cache when possible */
+static int ov5647_update_bits(struct ov5647 *ov5647, uint16_t reg,
+			      uint8_t mask, uint8_t val)
+{
+	uint8_t reg_val;
+	int ret;
+
+	ret = ov5647_read_reg_8bit(ov5647, reg, &reg_val);
+	if (ret)
+		return ret;
+
+	return ov5647_write_reg_8bit(ov5647, reg, (reg_val & ~mask) | (val & mask));
+}
+
+/*
+ * Number of entries starting at regs[0] that target consecutive addresses
+ * and can therefore go out as a single auto-increment write.
+ */
+static unsigned int ov5647_burst_len(struct ov5647 *ov5647,
+				     const struct ov5647_reg *regs,
+				     unsigned int len)
+{
+	unsigned int n = 1;
+
+	while (n < len && n < ov5647->burst_max &&
+	       regs[n].address == regs[0].address + n)
+		n++;
+
+	return n;
+}
+
+/*
+ * Submit a sequence of write messages in as few i2c_transfer() calls as the
+ * adapter allows. Adapters that refuse multi-message transfers get the
+ * messages one at a time from then on.
+ */
+static int ov5647_transfer(struct ov5647 *ov5647, struct i2c_msg *msgs,
+			   unsigned int num)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(&ov5647->sd);
+	unsigned int i, n;
+	int ret;
+
+	for (i = 0; i < num; i += n) {
+		n = min(num - i, ov5647->batch_max);
+		ret = i2c_transfer(client->adapter, &msgs[i], n);
+		if (ret == -EOPNOTSUPP && n > 1) {
+			dev_info(&client->dev,
+				 "adapter rejects batched writes, falling back\n");
+			ov5647->batch_max = 1;
+			n = 0;
+			continue;
+		}
+		if (ret != n)
+			return ret < 0 ? ret : -EIO;
 	}
 
 	return 0;
@@ -717,23 +1276,84 @@ static int ov5647_write_reg_8bit(struct ov5647 *ov5647, uint16_t reg, uint8_t va
 static int ov5647_write_regs(struct ov5647 *ov5647, const struct ov5647_reg *regs, int len) 
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&ov5647->sd);
-	unsigned int i;
+	struct ov5647_reg *todo;
+	struct i2c_msg *msgs;
+	uint8_t *buf, *p;
+	unsigned int i, j, n, cnt = 0, num = 0;
+	ktime_t start;
 	int ret;
 
-	printk("ov5647_write_regs:: len : %d", len);
+	if (len <= 0)
+		return 0;
+
+	/* Each message carries at least one register: 3 bytes per entry max */
+	todo = kmalloc_array(len, sizeof(*todo), GFP_KERNEL);
+	msgs = kmalloc_array(len, sizeof(*msgs), GFP_KERNEL);
+	buf = kmalloc_array(len, 3, GFP_KERNEL);
+	if (!todo || !msgs || !buf) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* Skip writes the sensor already holds, the rest keep their order */
 	for (i = 0; i < len; i++) {
-		printk("%d : attempting to write %d to reg 0x%4.4x.", i, regs[i].val, regs[i].address);
-		ret = ov5647_write_reg_8bit(ov5647, regs[i].address, regs[i].val);
-		if (ret) {
-			dev_err_ratelimited(&client->dev,
-					    "Failed to write reg 0x%4.4x. error = %d\n",
-					    regs[i].address, ret);
+		if (ov5647_cache_match(ov5647, regs[i].address, regs[i].val))
+			continue;
+		ov5647_cache_set(ov5647, regs[i].address, regs[i].val);
+		todo[cnt++] = regs[i];
+	}
 
-			return ret;
-		}
+	for (i = 0, p = buf; i < cnt; i += n, p += n + 2) {
+		n = ov5647_burst_len(ov5647, &todo[i], cnt - i);
+
+		put_unaligned_be16(todo[i].address, p);
+		for (j = 0; j < n; j++)
+			p[2 + j] = todo[i + j].val;
+
+		msgs[num].addr = client->addr;
+		msgs[num].flags = 0;
+		msgs[num].len = n + 2;
+		msgs[num].buf = p;
+		num++;
 	}
 
-	return 0;
+	start = ktime_get();
+	ret = ov5647_transfer(ov5647, msgs, num);
+	trace_ov5647_reg_seq(regs[0].address, len, cnt, num, p - buf,
+			     ktime_to_ns(ktime_sub(ktime_get(), start)), ret);
+	if (ret) {
+		/* Unknown how much of the sequence landed */
+		ov5647_cache_invalidate(ov5647);
+		dev_err_ratelimited(&client->dev,
+				    "Failed to write %d regs from 0x%4.4x. error = %d\n",
+				    len, regs[0].address, ret);
+	}
+
+out:
+	kfree(buf);
+	kfree(msgs);
+	kfree(todo);
+	return ret;
+}
+
+/* Transfer limits, bounded by what the adapter reports it can handle */
+static void ov5647_init_xfer_limits(struct ov5647 *ov5647,
+				    struct i2c_client *client)
+{
+	const struct i2c_adapter_quirks *quirks = client->adapter->quirks;
+
+	ov5647->burst_max = OV5647_BURST_MAX_LEN;
+	ov5647->batch_max = OV5647_BATCH_MAX_MSGS;
+
+	if (!quirks)
+		return;
+
+	if (quirks->max_write_len)
+		ov5647->burst_max = min_t(unsigned int, ov5647->burst_max,
+					  max_t(int, quirks->max_write_len - 2, 1));
+	if (quirks->max_num_msgs)
+		ov5647->batch_max = min_t(unsigned int, ov5647->batch_max,
+					  quirks->max_num_msgs);
 }
 
 static inline struct ov5647 *to_ov5647(struct v4l2_subdev *_sd)
@@ -741,6 +1361,44 @@ static inline struct ov5647 *to_ov5647(struct v4l2_subdev *_sd)
 	return container_of(_sd, struct ov5647, sd);
 }
 
+/* Bits per pixel of the active format */
+static unsigned int ov5647_bpp(struct ov5647 *ov5647)
+{
+	return ov5647_code_bpp(ov5647->fmt.code);
+}
+
+/* Pixel rate of the active link configuration, format and lanes */
+static u64 ov5647_pixel_rate(struct ov5647 *ov5647)
+{
+	return OV5647_PIXEL_RATE_LANES(ov5647_link_pll_mult[ov5647->link_idx],
+				       ov5647_bpp(ov5647), ov5647->lanes);
+}
+
+/* The preset tables are written for two lanes, generated modes for any */
+static bool ov5647_mode_carried(struct ov5647 *ov5647,
+				const struct ov5647_mode *mode)
+{
+	return mode == &ov5647->gen_mode || ov5647->lanes == OV5647_MAX_LANES;
+}
+
+static void ov5647_timeline_begin(struct ov5647 *ov5647)
+{
+	spin_lock(&ov5647->timeline_lock);
+	ov5647->timeline_start = ktime_get();
+	memset(ov5647->timeline, 0, sizeof(ov5647->timeline));
+	spin_unlock(&ov5647->timeline_lock);
+}
+
+/* Only the first occurrence after a power on is kept */
+static void ov5647_timeline_mark(struct ov5647 *ov5647,
+				 enum ov5647_power_phase phase)
+{
+	spin_lock(&ov5647->timeline_lock);
+	if (!ov5647->timeline[phase])
+		ov5647->timeline[phase] = ktime_get();
+	spin_unlock(&ov5647->timeline_lock);
+}
+
 /* Verify chip ID */
 static int ov5647_identify_module(struct ov5647 *ov5647)
 {
@@ -748,7 +1406,6 @@ static int ov5647_identify_module(struct ov5647 *ov5647)
 	int ret;
 	uint8_t val_high, val_low;
 
-	printk("ov5647_identify_module::clinet addres :  %d", client->addr);
 	ret = ov5647_read_reg_8bit(ov5647, (uint16_t) OV5647_REG_CHIP_ID_HIGH, &val_high);
 	if (ret) {
 		dev_err(&client->dev, "failed to read chip id %x\n",
@@ -767,91 +1424,498 @@ static int ov5647_identify_module(struct ov5647 *ov5647)
 		dev_err(&client->dev, "chip id mismatch: %x!=%x\n",
 			OV5647_CHIP_ID_HIGH, val_high);
 		return -EIO;
-	} else {
-		printk("ov5647 :: chip is high match");
 	}
 
     if (val_low != OV5647_CHIP_ID_LOW ) {
 		dev_err(&client->dev, "chip id mismatch: %x!=%x\n",
 			OV5647_CHIP_ID_LOW, val_low);
 		return -EIO;
-	} else {
-		printk("ov5647 :: chip is low match");
 	}
 	return 0;
 }
 
-// //----- TODO --------
-// static int set_binning(struct ov5647 *ov5647)
-// {
-// 	enum binning_mode binning = BINNING_NONE;
-// 	// int ret = imx219_resolve_binning(ov5647, &binning); // TODO implement this
-// 	// if (ret < 0)
-// 	// 	return ret;
-    
-// 	switch (binning) {
-//         case BINNING_NONE:
-//             return ov5647_write_reg_8bit(ov5647, 
-//                     OV5647_REG_VER_BIN_FLIP_MIR, OV5647_VER_BINNING_DISABLE) 
-//                 + ov5647_write_reg_8bit(ov5647, 
-//                     OV5647_REG_HOR_BIN_FLIP_MIR, OV5647_HOR_BINNING_DISABLE);
-//         case BINNING_BOTH:
-//             return ov5647_write_reg_8bit(ov5647, 
-//                     OV5647_REG_VER_BIN_FLIP_MIR, OV5647_VER_BINNING_EN);  
-//                 + ov5647_write_reg_8bit(ov5647, 
-//                     OV5647_REG_HOR_BIN_FLIP_MIR, OV5647_HOR_BINNING_EN);
-//         case BINNING_VER:
-//             return ov5647_write_reg_8bit(ov5647, 
-//                     OV5647_REG_VER_BIN_FLIP_MIR, OV5647_VER_BINNING_EN);  
-//         case BINNING_HOR:
-//             return ov5647_write_reg_8bit(ov5647, 
-//                     OV5647_REG_HOR_BIN_FLIP_MIR, OV5647_HOR_BINNING_EN);
-// 	}
-// 	return -EINVAL;
-// }
-
 static int ov5647_set_virtual_channel(struct ov5647 *ov5647, int channel)
 {
-	u8 channel_id;
+	return ov5647_update_bits(ov5647, OV5647_REG_MIPI_CTRL14,
+				  3 << 6, channel << 6);
+}
+
+/* Does the mode table write addr at or after entry "from"? */
+static bool ov5647_mode_has_reg(const struct ov5647_mode *mode, uint16_t addr,
+				unsigned int from)
+{
+	const struct ov5647_reg_list *reg_list = &mode->reg_list;
+	unsigned int i;
+
+	for (i = from; i < reg_list->num_of_regs; i++)
+		if (reg_list->regs[i].address == addr)
+			return true;
+
+	return false;
+}
+
+/*
+ * Entry i of mode m is the first appearance of a register that not every
+ * mode table programs. Standby, reset and the volatile control registers
+ * are handled elsewhere and never count.
+ */
+static bool ov5647_is_reset_reg(unsigned int m, unsigned int i)
+{
+	uint16_t addr = supported_modes[m].reg_list.regs[i].address;
+	unsigned int k;
+
+	if (ov5647_reg_volatile(addr))
+		return false;
+
+	for (k = 0; k < m; k++)
+		if (ov5647_mode_has_reg(&supported_modes[k], addr, 0))
+			return false;
+
+	for (k = 0; k < i; k++)
+		if (supported_modes[m].reg_list.regs[k].address == addr)
+			return false;
+
+	/* No earlier mode writes it, so unless this is the first mode it varies */
+	if (m > 0)
+		return true;
+
+	for (k = m + 1; k < ARRAY_SIZE(supported_modes); k++)
+		if (!ov5647_mode_has_reg(&supported_modes[k], addr, 0))
+			return true;
+
+	return false;
+}
+
+/*
+ * Read back the power-on defaults of the registers some modes leave
+ * untouched. Must run while the sensor is fresh from power-on.
+ */
+static int ov5647_init_reset_regs(struct ov5647 *ov5647)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(&ov5647->sd);
+	unsigned int m, i, n = 0;
 	int ret;
 
-	ret = ov5647_read_reg_8bit(ov5647, OV5647_REG_MIPI_CTRL14, &channel_id);
-	if (ret < 0)
+	for (m = 0; m < ARRAY_SIZE(supported_modes); m++)
+		for (i = 0; i < supported_modes[m].reg_list.num_of_regs; i++)
+			n += ov5647_is_reset_reg(m, i);
+
+	ov5647->reset_regs = devm_kcalloc(&client->dev, n,
+					  sizeof(*ov5647->reset_regs),
+					  GFP_KERNEL);
+	if (!ov5647->reset_regs)
+		return -ENOMEM;
+
+	for (m = 0, n = 0; m < ARRAY_SIZE(supported_modes); m++) {
+		const struct ov5647_reg_list *reg_list = &supported_modes[m].reg_list;
+
+		for (i = 0; i < reg_list->num_of_regs; i++) {
+			struct ov5647_reg *reg = &ov5647->reset_regs[n];
+
+			if (!ov5647_is_reset_reg(m, i))
+				continue;
+
+			reg->address = reg_list->regs[i].address;
+			ret = ov5647_read_reg_8bit(ov5647, reg->address, &reg->val);
+			if (ret)
+				return ret;
+			n++;
+		}
+	}
+	ov5647->num_reset_regs = n;
+
+	return 0;
+}
+
+/*
+ * First contact with a powered sensor: check the chip ID and read the
+ * register defaults used by delta mode loads. Runs from probe, or on first
+ * use with lazy_detect.
+ */
+static int ov5647_detect(struct ov5647 *ov5647)
+{
+	int ret;
+
+	if (ov5647->detected)
+		return 0;
+
+	ret = ov5647_identify_module(ov5647);
+	if (ret)
+		return ret;
+
+	ret = ov5647_init_reset_regs(ov5647);
+	if (ret)
+		return ret;
+
+	ov5647->detected = true;
+	return 0;
+}
+
+/*
+ * Registers that follow the pixel rate: MIPI clock period and banding. The
+ * period is the link's, stretched as the pixel rate drops below the 10 bit
+ * two lane one.
+ */
+#define OV5647_TIMING_REGS	7
+
+static unsigned int ov5647_timing_regs(unsigned int link, unsigned int bpp,
+				       unsigned int lanes, u32 hts, u32 vts,
+				       struct ov5647_reg *regs)
+{
+	u64 rate = OV5647_PIXEL_RATE_LANES(ov5647_link_pll_mult[link], bpp,
+					   lanes);
+	u32 b50 = max_t(u32, div_u64(rate, (u64)hts * 100), 1);
+	u32 b60 = max_t(u32, div_u64(rate, (u64)hts * 120), 1);
+	const struct ov5647_reg timing[] = {
+		OV5647_REG16(OV5647_REG_B50_STEP_HI, min_t(u32, b50, 0x3ff)),
+		OV5647_REG16(OV5647_REG_B60_STEP_HI, min_t(u32, b60, 0x3ff)),
+		{ OV5647_REG_B60_MAX, clamp_t(u32, vts / b60, 1, 0x3f) },
+		{ OV5647_REG_B50_MAX, clamp_t(u32, vts / b50, 1, 0x3f) },
+		{ OV5647_REG_PCLK_PERIOD,
+		  min_t(u32, DIV_ROUND_UP(ov5647_link_pclk_period[link] * bpp *
+					  OV5647_MAX_LANES, 10 * lanes), 0xff) },
+	};
+
+	BUILD_BUG_ON(ARRAY_SIZE(timing) != OV5647_TIMING_REGS);
+	memcpy(regs, timing, sizeof(timing));
+
+	return ARRAY_SIZE(timing);
+}
+
+/*
+ * Program a mode. The first load after power-on writes the common init,
+ * soft reset included, followed by the mode's own table. While the sensor
+ * stays powered only the mode table goes out: registers it leaves alone go
+ * back to their defaults, and the shadow cache drops entries the sensor
+ * already holds. A generated mode also rewrites common registers, so the
+ * load after one starts over from the common init. The MIPI bit mode
+ * follows the active format and the lane count sets 0x3018 and the system
+ * divider. When the pixel rate differs from the one the
+ * table was written for, through the link or the bit depth, the multiplier
+ * and the registers that follow the pixel rate are patched on top, and the
+ * next load is a full one.
+ */
+static int ov5647_load_mode(struct ov5647 *ov5647, const struct ov5647_mode *mode)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(&ov5647->sd);
+	const struct ov5647_reg_list *reg_list = &mode->reg_list;
+	struct ov5647_reg *regs;
+	unsigned int i, n = 0;
+	u64 rate;
+	int ret;
+
+	regs = kmalloc_array(ARRAY_SIZE(ov5647_common_regs) +
+			     ov5647->num_reset_regs + reg_list->num_of_regs +
+			     4 + OV5647_TIMING_REGS,
+			     sizeof(*regs), GFP_KERNEL);
+	if (!regs)
+		return -ENOMEM;
+
+	if (ov5647->loaded_mode == &ov5647->gen_mode || ov5647->loaded_patched)
+		ov5647->loaded_mode = NULL;
+
+	if (!ov5647->loaded_mode) {
+		dev_dbg(&client->dev, "full load of %ux%u\n", mode->width, mode->height);
+		memcpy(regs, ov5647_common_regs, sizeof(ov5647_common_regs));
+		n = ARRAY_SIZE(ov5647_common_regs);
+	} else {
+		dev_dbg(&client->dev, "delta load %ux%u -> %ux%u\n",
+			ov5647->loaded_mode->width, ov5647->loaded_mode->height,
+			mode->width, mode->height);
+
+		/* Reprogram from software standby */
+		regs[n].address = OV5647_SW_STANDBY;
+		regs[n++].val = 0x00;
+
+		for (i = 0; i < ov5647->num_reset_regs; i++)
+			if (!ov5647_mode_has_reg(mode, ov5647->reset_regs[i].address, 0))
+				regs[n++] = ov5647->reset_regs[i];
+	}
+
+	memcpy(&regs[n], reg_list->regs, reg_list->num_of_regs * sizeof(*regs));
+	n += reg_list->num_of_regs;
+
+	regs[n].address = OV5647_REG_PLL_CTRL0;
+	regs[n++].val = ov5647_bpp(ov5647) == 8 ? OV5647_PLL_CTRL0_MIPI8 :
+						  OV5647_PLL_CTRL0_MIPI10;
+	regs[n].address = OV5647_REG_PLL_CTRL1;
+	regs[n++].val = ov5647->lanes == 1 ? OV5647_PLL_CTRL1_1LANE :
+					     OV5647_PLL_CTRL1_VAL;
+	regs[n].address = OV5647_REG_MIPI_SC_CTRL;
+	regs[n++].val = (OV5647_MIPI_SC_CTRL_VAL & ~OV5647_MIPI_SC_LANES_MASK) |
+			(ov5647->lanes == 1 ? OV5647_MIPI_SC_1LANE :
+					      OV5647_MIPI_SC_2LANE);
+
+	rate = ov5647_pixel_rate(ov5647);
+	if (rate != mode->pixel_rate) {
+		regs[n].address = OV5647_REG_PLL_MULT;
+		regs[n++].val = ov5647_link_pll_mult[ov5647->link_idx];
+		n += ov5647_timing_regs(ov5647->link_idx, ov5647_bpp(ov5647),
+					ov5647->lanes, mode->hts_def,
+					mode->vts_def, &regs[n]);
+	}
+
+	ret = ov5647_write_regs(ov5647, regs, n);
+	kfree(regs);
+	trace_ov5647_mode_change(mode->width, mode->height, !ov5647->loaded_mode,
+				 n, ret);
+
+	ov5647->loaded_mode = ret ? NULL : mode;
+	ov5647->loaded_link = ov5647->link_idx;
+	ov5647->loaded_bpp = ov5647_bpp(ov5647);
+	ov5647->loaded_patched = rate != mode->pixel_rate;
+	return ret;
+}
+
+/* Odd/even increment pair reading every skip'th Bayer quad */
+static uint8_t ov5647_skip_inc(unsigned int skip)
+{
+	switch (skip) {
+	case 4:
+		return 0x35;
+	case 2:
+		return 0x31;
+	default:
+		return 0x11;
+	}
+}
+
+/*
+ * Program the active readout over the mode's own: array window, output
+ * size, subsampling and binning. The binning bits are merged into
+ * 0x3820/0x3821 around the flip bits. Cached, so nothing goes out when the
+ * readout is the one the mode table left behind.
+ */
+static int ov5647_write_readout(struct ov5647 *ov5647)
+{
+	const struct ov5647_mode *mode = ov5647->mode;
+	const struct v4l2_rect *c = &ov5647->crop;
+	u32 x_start = c->left - OV5647_PIXEL_ARRAY_LEFT;
+	u32 y_start = c->top - OV5647_PIXEL_ARRAY_TOP;
+	u32 x_end = x_start + ov5647->width * ov5647->skip_x +
+		    mode->win_pad_x - 1;
+	u32 y_end = y_start + ov5647->height * ov5647->skip_y +
+		    mode->win_pad_y - 1;
+	const struct ov5647_reg regs[] = {
+		OV5647_REG16(OV5647_REG_X_ADDR_START_HIGH, x_start),
+		OV5647_REG16(OV5647_REG_Y_ADDR_START_HIGH, y_start),
+		OV5647_REG16(OV5647_REG_X_ADDR_END_HIGH, x_end),
+		OV5647_REG16(OV5647_REG_Y_ADDR_END_HIGH, y_end),
+		OV5647_REG16(OV5647_REG_X_OUTPUT_SIZE_HIGH, ov5647->width),
+		OV5647_REG16(OV5647_REG_Y_OUTPUT_SIZE_HIGH, ov5647->height),
+		{ OV5647_REG_X_INC, ov5647_skip_inc(ov5647->skip_x) },
+		{ OV5647_REG_Y_INC, ov5647_skip_inc(ov5647->skip_y) },
+	};
+	int ret;
+
+	ret = ov5647_write_regs(ov5647, regs, ARRAY_SIZE(regs));
+	if (ret)
+		return ret;
+
+	ret = ov5647_update_bits(ov5647, OV5647_REG_VER_BIN_FLIP_MIR,
+				 (uint8_t)~OV5647_FLIP_MIRROR_MASK,
+				 OV5647_VER_BIN_VAL(ov5647->binning));
+	if (ret)
 		return ret;
 
-	channel_id &= ~(3 << 6);
+	return ov5647_update_bits(ov5647, OV5647_REG_HOR_BIN_FLIP_MIR,
+				  (uint8_t)~OV5647_FLIP_MIRROR_MASK,
+				  OV5647_HOR_BIN_VAL(ov5647->binning));
+}
 
-	return ov5647_write_reg_8bit(ov5647, OV5647_REG_MIPI_CTRL14,
-			    							channel_id | (channel << 6));
+/* Length of a frame of vts lines in the active mode */
+static u64 ov5647_frame_ns(struct ov5647 *ov5647, u32 vts)
+{
+	return div_u64((u64)vts * ov5647->mode->hts_def * NSEC_PER_SEC,
+		       ov5647_pixel_rate(ov5647));
 }
 
+static struct ov5647_frame_meta *ov5647_meta_at(struct ov5647 *ov5647,
+						unsigned int age)
+{
+	return &ov5647->meta[(ov5647->meta_head - age) % OV5647_META_DEPTH];
+}
+
+/* Frame started at or before now, from the newest record already reached */
+static u32 ov5647_meta_frame(struct ov5647 *ov5647, u64 now)
+{
+	const struct ov5647_frame_meta *m;
+	unsigned int i;
+
+	for (i = 0; i < ov5647->meta_count; i++) {
+		m = ov5647_meta_at(ov5647, i);
+		if (m->timestamp <= now)
+			return m->sequence +
+			       div64_u64(now - m->timestamp,
+					 ov5647_frame_ns(ov5647, m->vts));
+	}
+
+	return 0;
+}
+
+/* Newest record at or before frame sequence, NULL if it is older than all */
+static const struct ov5647_frame_meta *ov5647_meta_find(struct ov5647 *ov5647,
+							u32 sequence)
+{
+	const struct ov5647_frame_meta *m;
+	unsigned int i;
+
+	for (i = 0; i < ov5647->meta_count; i++) {
+		m = ov5647_meta_at(ov5647, i);
+		if (m->sequence <= sequence)
+			return m;
+	}
+
+	return NULL;
+}
+
+/* Estimated start of a frame covered by record m */
+static u64 ov5647_meta_start(struct ov5647 *ov5647,
+			     const struct ov5647_frame_meta *m, u32 sequence)
+{
+	return m->timestamp +
+	       (sequence - m->sequence) * ov5647_frame_ns(ov5647, m->vts);
+}
+
+/*
+ * Record the state frames carry from sequence on, replacing records for
+ * that frame or later ones. The start of the frame follows from the
+ * record before it.
+ */
+static void ov5647_meta_push(struct ov5647 *ov5647, u32 sequence,
+			     u32 exposure, u32 gain, u32 vts)
+{
+	const struct ov5647_frame_meta *prev;
+	struct ov5647_frame_meta *m;
+	u64 timestamp = ktime_get_ns();
+	unsigned long flags;
+
+	spin_lock_irqsave(&ov5647->frame_lock, flags);
+	while (ov5647->meta_count &&
+	       ov5647_meta_at(ov5647, 0)->sequence >= sequence) {
+		ov5647->meta_head--;
+		ov5647->meta_count--;
+	}
+
+	if (ov5647->meta_count) {
+		prev = ov5647_meta_at(ov5647, 0);
+		timestamp = ov5647_meta_start(ov5647, prev, sequence);
+	}
+
+	ov5647->meta_head++;
+	ov5647->meta_count = min_t(unsigned int, ov5647->meta_count + 1,
+				   OV5647_META_DEPTH);
+	m = ov5647_meta_at(ov5647, 0);
+	m->sequence = sequence;
+	m->exposure = exposure;
+	m->gain = gain;
+	m->vts = vts;
+	m->timestamp = timestamp;
+	spin_unlock_irqrestore(&ov5647->frame_lock, flags);
+}
+
+/*
+ * Frame timing model: alternate between the start of frame sync_frame,
+ * announced with V4L2_EVENT_FRAME_SYNC, and the start of its vertical
+ * blanking, where the queued control set due in that frame is kicked off
+ * so its group hold goes out between frames.
+ */
+static enum hrtimer_restart ov5647_frame_timer(struct hrtimer *timer)
+{
+	struct ov5647 *ov5647 = container_of(timer, struct ov5647, frame_timer);
+	struct v4l2_event ev = {
+		.type = V4L2_EVENT_FRAME_SYNC,
+	};
+	const struct ov5647_frame_meta *m;
+	bool sync = false, kick = false;
+	u32 frame;
+	u64 next;
+
+	spin_lock(&ov5647->frame_lock);
+	if (!ov5647->sync_vblank) {
+		frame = ov5647->sync_frame++;
+		m = ov5647_meta_find(ov5647, frame);
+		if (!m)
+			goto out_stop;
+		next = ov5647_meta_start(ov5647, m, frame) +
+		       ov5647_frame_ns(ov5647, ov5647->height);
+		ev.u.frame_sync.frame_sequence = frame;
+		sync = true;
+	} else {
+		frame = ov5647->sync_frame - 1;
+		if (ov5647->frame_ctrls_armed &&
+		    (s32)(ov5647->frame_ctrls_issue - frame) <= 0) {
+			ov5647->frame_ctrls_armed = false;
+			kick = true;
+		}
+		m = ov5647_meta_find(ov5647, ov5647->sync_frame);
+		if (!m)
+			goto out_stop;
+		next = ov5647_meta_start(ov5647, m, ov5647->sync_frame);
+	}
+	ov5647->sync_vblank = !ov5647->sync_vblank;
+	spin_unlock(&ov5647->frame_lock);
+
+	if (sync && ov5647->sd.devnode)
+		v4l2_event_queue(ov5647->sd.devnode, &ev);
+	if (kick)
+		queue_work(system_highpri_wq, &ov5647->frame_ctrls_work);
+
+	hrtimer_set_expires(timer, ns_to_ktime(next));
+	return HRTIMER_RESTART;
+
+out_stop:
+	/* No record covers the frame, the model has nothing to go on */
+	spin_unlock(&ov5647->frame_lock);
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * A restart in the mode that is still loaded skips the table and, unless a
+ * control changed while the sensor could not take it, the control setup:
+ * only the standby bit and MIPI_CTRL00 change state in that case.
+ */
 static int ov5647_start_streaming(struct ov5647 *ov5647)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&ov5647->sd);
-	const struct ov5647_reg_list *reg_list;
 	uint8_t val = MIPI_CTRL00_BUS_IDLE;
+	u32 vts;
 	int ret;
 
-	printk(" ov5647_start_streaming");
 
 	ret = pm_runtime_resume_and_get(&client->dev);
 	if (ret < 0)
 		return ret;
 
-	/* Apply default values of current mode */
-	reg_list = &ov5647->mode->reg_list;
-	ret = ov5647_write_regs(ov5647, reg_list->regs, reg_list->num_of_regs);
-	if (ret) {
-		printk( "%s failed to set mode\n", __func__);
+	ret = ov5647_detect(ov5647);
+	if (ret)
 		goto err_rpm_put;
+
+	/* Apply default values of current mode */
+	if (ov5647->loaded_mode != ov5647->mode ||
+	    ov5647->loaded_link != ov5647->link_idx ||
+	    ov5647->loaded_bpp != ov5647_bpp(ov5647)) {
+		ret = ov5647_load_mode(ov5647, ov5647->mode);
+		if (ret) {
+			dev_err(&client->dev, "%s failed to set mode\n", __func__);
+			goto err_rpm_put;
+		}
+		ov5647->ctrls_stale = true;
+		ov5647_timeline_mark(ov5647, OV5647_PHASE_MODE);
+	} else {
+		dev_dbg(&client->dev, "warm restart of %ux%u\n",
+			ov5647->mode->width, ov5647->mode->height);
 	}
 
+	ret = ov5647_write_readout(ov5647);
+	if (ret)
+		goto err_rpm_put;
+
 	ret = ov5647_set_virtual_channel(ov5647, 0);
 	if (ret < 0)
-		return ret;
+		goto err_rpm_put;
 
 	/* set stream on register */
-	printk("Device is set in SW standby");
 	ret = ov5647_write_reg_8bit(ov5647, OV5647_SW_STANDBY, 0x01);
 	if (ret)
 		goto err_rpm_put;
@@ -861,54 +1925,115 @@ static int ov5647_start_streaming(struct ov5647 *ov5647)
 	__v4l2_ctrl_grab(ov5647->hflip, true);
 
 	/* Apply customized values from user */
-	ret =  __v4l2_ctrl_handler_setup(ov5647->sd.ctrl_handler);
-	if (ret)
-		goto err_rpm_put;
+	if (ov5647->ctrls_stale) {
+		ret =  __v4l2_ctrl_handler_setup(ov5647->sd.ctrl_handler);
+		if (ret)
+			goto err_rpm_put;
+		ov5647->ctrls_stale = false;
+	}
 
 	if (ov5647->clock_ncont) 
 		val |= MIPI_CTRL00_CLOCK_LANE_GATE | MIPI_CTRL00_LINE_SYNC_ENABLE;
 
 	ret = ov5647_write_reg_8bit(ov5647, OV5647_REG_MIPI_CTRL00, val);
 	if (ret < 0)
-		return ret;
+		goto err_rpm_put;
+	ov5647_timeline_mark(ov5647, OV5647_PHASE_STREAM);
 
+	/* Both are cached, a warm restart sends neither */
 	ret = ov5647_write_reg_8bit(ov5647, OV5647_REG_FRAME_OFF_NUMBER, 0x00);
 	if (ret < 0)
-		return ret;
+		goto err_rpm_put;
 
 	ret = ov5647_write_reg_8bit(ov5647, OV5640_REG_PAD_OUT, 0x00);
 	if (ret < 0)
-		return ret;
+		goto err_rpm_put;
+
+	/* Frame 0 starts now, with the values the controls hold */
+	vts = ov5647->height + ov5647->vblank->val;
+	spin_lock_irq(&ov5647->frame_lock);
+	ov5647->meta_count = 0;
+	ov5647->sync_frame = 0;
+	ov5647->sync_vblank = false;
+	ov5647->frame_ctrls_armed = false;
+	spin_unlock_irq(&ov5647->frame_lock);
+	ov5647_meta_push(ov5647, 0,
+			 min_t(u32, ov5647->exposure->val,
+			       vts - OV5647_EXPOSURE_MARGIN),
+			 ov5647->gain->val, vts);
+	hrtimer_start(&ov5647->frame_timer,
+		      ns_to_ktime(ov5647_meta_at(ov5647, 0)->timestamp),
+		      HRTIMER_MODE_ABS);
 
-	printk(" ov5647_start_streaming :: return 0");
 	return 0;
 
 err_rpm_put:
-	pm_runtime_put(&client->dev);
+	__v4l2_ctrl_grab(ov5647->vflip, false);
+	__v4l2_ctrl_grab(ov5647->hflip, false);
+	pm_runtime_mark_last_busy(&client->dev);
+	pm_runtime_put_autosuspend(&client->dev);
 	return ret;
 }
 
+/*
+ * Park the sensor in software standby with the MIPI bus in LP-11. The
+ * registers keep their values, so a restart in the same mode is warm. Only
+ * once the sensor has been idle for the autosuspend delay does runtime PM
+ * power it off.
+ */
 static void ov5647_stop_streaming(struct ov5647 *ov5647)
 {
-	printk(" ov5647_stop_streaming");
-	return;
+	struct i2c_client *client = v4l2_get_subdevdata(&ov5647->sd);
+
+	/* Deferred controls still pending are programmed on the next start */
+	if (ov5647->ctrl_pending.dirty) {
+		ov5647->ctrl_pending.dirty = 0;
+		ov5647->ctrls_stale = true;
+	}
+
+	/*
+	 * Frame numbers restart with the next stream. ov5647_set_stream()
+	 * waits for a frame_ctrls_work run already queued once it has dropped
+	 * the mutex that run needs.
+	 */
+	hrtimer_cancel(&ov5647->frame_timer);
+	ov5647->num_frame_ctrls = 0;
+
+	if (ov5647_write_reg_8bit(ov5647, OV5647_REG_MIPI_CTRL00,
+				  MIPI_CTRL00_CLOCK_LANE_GATE |
+				  MIPI_CTRL00_BUS_IDLE |
+				  MIPI_CTRL00_CLOCK_LANE_DISABLE) ||
+	    ov5647_write_reg_8bit(ov5647, OV5647_SW_STANDBY, 0x00)) {
+		dev_err(&client->dev, "%s failed to enter standby\n", __func__);
+		/* Unknown state, the next start reloads everything */
+		ov5647->loaded_mode = NULL;
+	}
+
+	__v4l2_ctrl_grab(ov5647->vflip, false);
+	__v4l2_ctrl_grab(ov5647->hflip, false);
+
+	/* Stay in standby for the autosuspend delay before powering off */
+	pm_runtime_mark_last_busy(&client->dev);
+	pm_runtime_put_autosuspend(&client->dev);
 }
 
 static int ov5647_set_stream(struct v4l2_subdev *sd, int enable) 
 {
 
 	struct ov5647 *ov5647 = to_ov5647(sd);
-	int ret ;
+	ktime_t start;
+	int ret = 0;
 
-	printk(" ov5647_set_stream starting : %d", enable); 
 	mutex_lock(&ov5647->mutex);
 	if (ov5647->streaming == enable) {
 		mutex_unlock(&ov5647->mutex);
 		return 0;
 	}
 
+	start = ktime_get();
 	if (enable) {
-		if (ov5647_start_streaming(ov5647))
+		ret = ov5647_start_streaming(ov5647);
+		if (ret)
 			goto err_unlock;
 	} else {
 		ov5647_stop_streaming(ov5647);
@@ -916,8 +2041,16 @@ static int ov5647_set_stream(struct v4l2_subdev *sd, int enable)
 	ov5647->streaming = enable;
 
 err_unlock:
+	trace_ov5647_stream(enable, ktime_to_ns(ktime_sub(ktime_get(), start)), ret);
 	mutex_unlock(&ov5647->mutex);
-	printk(" ov5647_set_stream:: return 0");
+
+	/*
+	 * A frame_ctrls_work run may be blocked on the mutex. It finds the
+	 * stream stopped and returns; wait for it so no write of this stream
+	 * is left over once stream off returns.
+	 */
+	if (!enable)
+		cancel_work_sync(&ov5647->frame_ctrls_work);
 	return ret;
 }
 
@@ -928,16 +2061,29 @@ static int ov5647_open(struct v4l2_subdev *sd, struct v4l2_subdev_fh *fh)
 	struct ov5647 *ov5647 = to_ov5647(sd);
 	struct v4l2_mbus_framefmt *try_fmt_img;
 	struct v4l2_rect *try_crop;
+	struct i2c_client *client = v4l2_get_subdevdata(sd);
+	int ret = 0;
 
-	printk("ov5647_open");
 
 	mutex_lock(&ov5647->mutex);
 
+	/* With lazy_detect, the first open is the first time we look */
+	if (!ov5647->detected) {
+		ret = pm_runtime_resume_and_get(&client->dev);
+		if (ret < 0)
+			goto out_unlock;
+		ret = ov5647_detect(ov5647);
+		pm_runtime_mark_last_busy(&client->dev);
+		pm_runtime_put_autosuspend(&client->dev);
+		if (ret)
+			goto out_unlock;
+	}
+
 	/* Initialize try_fmt */
 	try_fmt_img = v4l2_subdev_get_try_format(sd, fh->state, 0);
 	try_fmt_img->width = supported_modes[3].width;
 	try_fmt_img->height = supported_modes[3].height;
-	try_fmt_img->code = MEDIA_BUS_FMT_SRGGB10_1X10;
+	try_fmt_img->code = ov5647_mbus_codes[0];
 	try_fmt_img->colorspace = V4L2_COLORSPACE_RAW;
 	try_fmt_img->field = V4L2_FIELD_NONE;
 
@@ -947,9 +2093,10 @@ static int ov5647_open(struct v4l2_subdev *sd, struct v4l2_subdev_fh *fh)
 	try_crop->width = OV5647_PIXEL_ARRAY_WIDTH;
 	try_crop->height = OV5647_PIXEL_ARRAY_HEIGHT;
 
+out_unlock:
 	mutex_unlock(&ov5647->mutex);
 
-	return 0;
+	return ret;
 }
 
 static void free_controls(struct ov5647 *ov5647)
@@ -966,59 +2113,105 @@ static int get_regulators(struct ov5647 *ov5647, struct device *dev)
 		ov5647->supplies[i].supply = ov5647_supply_name[i];
 	}
 
-	printk("get_regulators::devm_regulator_bulk_get");
 	return devm_regulator_bulk_get(dev,
 					OV5647_NUM_SUPPLIES,
 					ov5647->supplies);
 }
 
 /* Power/clock management functions */
+static int ov5647_timeline_show(struct seq_file *m, void *unused)
+{
+	struct ov5647 *ov5647 = m->private;
+	ktime_t timeline[OV5647_PHASE_NUM];
+	ktime_t start, prev;
+	unsigned int i;
+
+	spin_lock(&ov5647->timeline_lock);
+	start = ov5647->timeline_start;
+	memcpy(timeline, ov5647->timeline, sizeof(timeline));
+	spin_unlock(&ov5647->timeline_lock);
+
+	if (!start) {
+		seq_puts(m, "no power on recorded\n");
+		return 0;
+	}
+
+	prev = start;
+	for (i = 0; i < OV5647_PHASE_NUM; i++) {
+		if (!timeline[i]) {
+			seq_printf(m, "%-14s        -\n", ov5647_phase_names[i]);
+			continue;
+		}
+		seq_printf(m, "%-14s %8lld us (+%lld us)\n", ov5647_phase_names[i],
+			   ktime_us_delta(timeline[i], start),
+			   ktime_us_delta(timeline[i], prev));
+		prev = timeline[i];
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ov5647_timeline);
+
 static int power_on(struct device *dev)
 {
 	struct ov5647 *ov5647 = dev_get_drvdata(dev);
 	int ret;
 
 	dev_dbg(dev, "OV5647 power on\n");
+	ov5647_timeline_begin(ov5647);
 
 	ret = regulator_bulk_enable(OV5647_NUM_SUPPLIES,
 				    ov5647->supplies);
 	if (ret) {
-		printk( "%s: failed to enable regulators\n", __func__);
+		dev_err(dev, "%s: failed to enable regulators\n", __func__);
 		return ret;
 	}
+	ov5647_timeline_mark(ov5647, OV5647_PHASE_REGULATORS);
 
-	if (ov5647->pwr_gpio) {
+	if (ov5647->pwr_gpio)
 		gpiod_set_value_cansleep(ov5647->pwr_gpio, 0);
-		msleep(PWDN_ACTIVE_DELAY_MS);
-	}
+	ov5647_timeline_mark(ov5647, OV5647_PHASE_PWDN);
 
 	ret = clk_prepare_enable(ov5647->xclk);
 	if (ret) {
-		printk("%s: failed to enable clock\n", __func__);
+		dev_err(dev, "%s: failed to enable clock\n", __func__);
 		goto reg_off;
 	}
 
-	msleep(PWDN_ACTIVE_DELAY_MS);
+	/* Internal boot runs off XCLK, count from when it is stable */
+	fsleep(OV5647_PWDN_SCCB_DELAY_US +
+	       DIV_ROUND_UP_ULL((u64)OV5647_BOOT_XCLK_CYCLES * USEC_PER_SEC,
+				ov5647->xclk_freq));
+	ov5647_timeline_mark(ov5647, OV5647_PHASE_XCLK);
 
 	ret = ov5647_write_regs(ov5647, sensor_oe_enable_regs,
 				 ARRAY_SIZE(sensor_oe_enable_regs));
 	if (ret < 0) {
-		printk( "write sensor_oe_enable_regs error\n");
-		goto reg_off;
+		dev_err(dev, "write sensor_oe_enable_regs error\n");
+		goto clk_off;
 	}
 
+	/* sensor doesn't enter LP-11 state upon power up until and unless
+	 * streaming is started, so upon power up switch the modes to:
+	 * streaming -> standby
+	 */
+	ret = ov5647_write_reg_8bit(ov5647, OV5647_REG_MIPI_CTRL00, MIPI_CTRL00_CLOCK_LANE_GATE 
+									| MIPI_CTRL00_BUS_IDLE | MIPI_CTRL00_CLOCK_LANE_DISABLE);
+	if (ret < 0)
+		goto clk_off;
+	ov5647_timeline_mark(ov5647, OV5647_PHASE_OE);
+
 	return 0;
 
+clk_off:
+	clk_disable_unprepare(ov5647->xclk);
 reg_off:
 	gpiod_set_value_cansleep(ov5647->pwr_gpio, 1);
 	regulator_bulk_disable(OV5647_NUM_SUPPLIES, ov5647->supplies);
 
-	ret = ov5647_write_regs(ov5647, sensor_oe_disable_regs,
-				 ARRAY_SIZE(sensor_oe_disable_regs));
-	if (ret < 0) {
-		printk( "write sensor_oe_disable_regs error\n");
-	}
-	clk_disable_unprepare(ov5647->xclk);
+	/* As in power_off(), drop whatever a partial write left cached */
+	ov5647_cache_invalidate(ov5647);
+	ov5647->loaded_mode = NULL;
 
 	return ret;
 }
@@ -1032,6 +2225,10 @@ static int power_off(struct device *dev)
 	regulator_bulk_disable(OV5647_NUM_SUPPLIES, ov5647->supplies);
 	clk_disable_unprepare(ov5647->xclk);
 
+	/* Register contents are lost, resync from the next writes/reads */
+	ov5647_cache_invalidate(ov5647);
+	ov5647->loaded_mode = NULL;
+
 	return 0;
 }
 
@@ -1040,7 +2237,7 @@ static void set_default_format(struct ov5647 *ov5647)
 	struct v4l2_mbus_framefmt *fmt;
 
 	fmt = &ov5647->fmt;
-	fmt->code = MEDIA_BUS_FMT_SRGGB10_1X10;
+	fmt->code = ov5647_mbus_codes[0];
 	fmt->colorspace = V4L2_COLORSPACE_RAW;
 	fmt->ycbcr_enc = V4L2_MAP_YCBCR_ENC_DEFAULT(fmt->colorspace);
 	fmt->quantization = V4L2_MAP_QUANTIZATION_DEFAULT(true,
@@ -1052,106 +2249,404 @@ static void set_default_format(struct ov5647 *ov5647)
 	fmt->field = V4L2_FIELD_NONE;
 }
 
+/* Worst case: every control in the batch changed at once */
+#define OV5647_CTRL_BATCH_REGS		16
+
+/*
+ * Turn every control changed by one S_EXT_CTRLS call into a single register
+ * sequence. Exposure, analogue gain and frame length go inside one group
+ * hold so the sensor latches them on the same frame boundary; they are laid
+ * out in address order so 0x3500-0x3503 leave as one burst. Exposure is in
+ * lines and is clamped to the frame length programmed alongside it.
+ */
+static int ov5647_apply_ctrls(struct ov5647 *ov5647,
+			      const struct ov5647_ctrl_batch *b)
+{
+	struct ov5647_reg regs[OV5647_CTRL_BATCH_REGS];
+	bool group = b->dirty & (BIT(OV5647_BATCH_EXPOSURE) |
+				 BIT(OV5647_BATCH_GAIN) |
+				 BIT(OV5647_BATCH_VBLANK));
+	u32 vts = ov5647->height + b->val[OV5647_BATCH_VBLANK];
+	u32 exposure = min_t(u32, b->val[OV5647_BATCH_EXPOSURE],
+			     vts - OV5647_EXPOSURE_MARGIN);
+	u32 gain = b->val[OV5647_BATCH_GAIN];
+	unsigned int n = 0;
+	uint8_t manual, flip;
+	u64 frame_ns;
+	int ret;
+
+#define OV5647_BATCH_REG(a, v) \
+	do { regs[n].address = (a); regs[n++].val = (v); } while (0)
+
+	if (group) {
+		OV5647_BATCH_REG(OV5647_REG_GROUP_ACCESS, OV5647_GROUP_HOLD_START);
+		OV5647_BATCH_REG(OV5647_REG_EXPOSURE2, (exposure >> 12) & 0x0f);
+		OV5647_BATCH_REG(OV5647_REG_EXPOSURE1, (exposure >> 4) & 0xff);
+		OV5647_BATCH_REG(OV5647_REG_EXPOSURE0, (exposure & 0x0f) << 4);
+	}
+
+	if (b->dirty & (BIT(OV5647_BATCH_AUTOGAIN) |
+			BIT(OV5647_BATCH_EXPOSURE_AUTO))) {
+		ret = ov5647_read_reg_8bit(ov5647, OV5647_REG_MANUAL_CTRL, &manual);
+		if (ret)
+			return ret;
+
+		manual &= ~(OV5647_MANUAL_GAIN | OV5647_MANUAL_EXPOSURE);
+		if (!b->val[OV5647_BATCH_AUTOGAIN])
+			manual |= OV5647_MANUAL_GAIN;
+		if (b->val[OV5647_BATCH_EXPOSURE_AUTO] == V4L2_EXPOSURE_MANUAL)
+			manual |= OV5647_MANUAL_EXPOSURE;
+		OV5647_BATCH_REG(OV5647_REG_MANUAL_CTRL, manual);
+	}
+
+	if (group) {
+		OV5647_BATCH_REG(OV564_REG_ANALOG_GAIN1, (gain >> 8) & 0x03);
+		OV5647_BATCH_REG(OV564_REG_ANALOG_GAIN0, gain & 0xff);
+		OV5647_BATCH_REG(OV5647_REG_VTS_HI, (vts >> 8) & 0xff);
+		OV5647_BATCH_REG(OV5647_REG_VTS_LO, vts & 0xff);
+		OV5647_BATCH_REG(OV5647_REG_GROUP_ACCESS, OV5647_GROUP_HOLD_END);
+		OV5647_BATCH_REG(OV5647_REG_GROUP_ACCESS, OV5647_GROUP_LAUNCH);
+	}
+
+	/*
+	 * Flip bits only: the binning bits in the same registers stay put. With
+	 * both controls at 0 neither flip nor mirror is on, as before.
+	 */
+	if (b->dirty & BIT(OV5647_BATCH_VFLIP)) {
+		ret = ov5647_read_reg_8bit(ov5647, OV5647_REG_VER_BIN_FLIP_MIR,
+					   &flip);
+		if (ret)
+			return ret;
+
+		flip &= ~OV5647_FLIP_MIRROR_MASK;
+		if (b->val[OV5647_BATCH_VFLIP])
+			flip |= OV5647_FLIP_MIRROR_MASK;
+		OV5647_BATCH_REG(OV5647_REG_VER_BIN_FLIP_MIR, flip);
+	}
+	if (b->dirty & BIT(OV5647_BATCH_HFLIP)) {
+		ret = ov5647_read_reg_8bit(ov5647, OV5647_REG_HOR_BIN_FLIP_MIR,
+					   &flip);
+		if (ret)
+			return ret;
+
+		flip &= ~OV5647_FLIP_MIRROR_MASK;
+		if (b->val[OV5647_BATCH_HFLIP])
+			flip |= OV5647_FLIP_MIRROR_MASK;
+		OV5647_BATCH_REG(OV5647_REG_HOR_BIN_FLIP_MIR, flip);
+	}
+	if (b->dirty & BIT(OV5647_BATCH_AWB))
+		OV5647_BATCH_REG(OV5647_REG_MIPI_AWB,
+				 b->val[OV5647_BATCH_AWB] ? 1 : 0);
+
+#undef OV5647_BATCH_REG
+
+	ret = ov5647_write_regs(ov5647, regs, n);
+
+	if (group) {
+		/* The new values reach the frame OV5647_GROUP_DELAY_FRAMES later */
+		frame_ns = ov5647_frame_ns(ov5647, vts);
+		if (!ret && ov5647->streaming)
+			ov5647_meta_push(ov5647,
+					 ov5647_meta_frame(ov5647, ktime_get_ns()) +
+					 OV5647_GROUP_DELAY_FRAMES,
+					 exposure, gain, vts);
+		trace_ov5647_group_hold(exposure, gain, vts,
+					OV5647_GROUP_DELAY_FRAMES,
+					OV5647_GROUP_DELAY_FRAMES * frame_ns, ret);
+	}
+
+	return ret;
+}
+
+/* Snapshot the cluster: every value, with the ones this call changed dirty */
+static void ov5647_batch_from_ctrls(struct ov5647 *ov5647,
+				    struct ov5647_ctrl_batch *b)
+{
+	struct v4l2_ctrl **cluster = &ov5647->exposure;
+	unsigned int i;
+
+	b->dirty = 0;
+	for (i = 0; i < OV5647_BATCH_NUM; i++) {
+		b->val[i] = cluster[i]->val;
+		if (cluster[i]->is_new)
+			__set_bit(i, &b->dirty);
+	}
+}
+
+/*
+ * Flush deferred controls. Values queued while this ran are merged into
+ * ctrl_pending and go out on the next run.
+ */
+static void ov5647_ctrl_work(struct work_struct *work)
+{
+	struct ov5647 *ov5647 = container_of(work, struct ov5647, ctrl_work);
+	struct i2c_client *client = v4l2_get_subdevdata(&ov5647->sd);
+	struct ov5647_event_ctrls_applied *applied;
+	struct ov5647_ctrl_batch batch;
+	struct v4l2_event ev = {
+		.type = V4L2_EVENT_OV5647_CTRLS_APPLIED,
+	};
+	int ret;
+
+	mutex_lock(&ov5647->mutex);
+	batch = ov5647->ctrl_pending;
+	ov5647->ctrl_pending.dirty = 0;
+	if (!batch.dirty)
+		goto out_unlock;
+
+	if (pm_runtime_get_if_in_use(&client->dev) <= 0) {
+		/* Stream stopped: handler setup programs the values next time */
+		ov5647->ctrls_stale = true;
+		goto out_unlock;
+	}
+
+	ret = ov5647_apply_ctrls(ov5647, &batch);
+	pm_runtime_put(&client->dev);
+	mutex_unlock(&ov5647->mutex);
+
+	applied = (struct ov5647_event_ctrls_applied *)ev.u.data;
+	applied->dirty = batch.dirty;
+	applied->error = ret;
+	v4l2_subdev_notify_event(&ov5647->sd, &ev);
+	return;
+
+out_unlock:
+	mutex_unlock(&ov5647->mutex);
+}
+
+/*
+ * Have the frame timer kick the work for the first queued set in the
+ * blanking of the frame OV5647_GROUP_DELAY_FRAMES before its own. If that
+ * blanking has already begun, the set goes out straight away.
+ */
+static void ov5647_frame_ctrls_schedule(struct ov5647 *ov5647)
+{
+	bool now = false;
+	u32 issue;
+
+	if (!ov5647->num_frame_ctrls)
+		return;
+
+	issue = ov5647->frame_ctrls[0].sequence - OV5647_GROUP_DELAY_FRAMES;
+
+	spin_lock_irq(&ov5647->frame_lock);
+	now = (s32)(issue + 1 - ov5647->sync_frame) < 0 ||
+	      (issue + 1 == ov5647->sync_frame && !ov5647->sync_vblank);
+	ov5647->frame_ctrls_issue = issue;
+	ov5647->frame_ctrls_armed = !now;
+	spin_unlock_irq(&ov5647->frame_lock);
+
+	if (now)
+		queue_work(system_highpri_wq, &ov5647->frame_ctrls_work);
+}
+
+/*
+ * Write the queued sets due in this frame as one group hold, on top of the
+ * values the sensor already holds. A set that is late still goes out and
+ * lands on the earliest frame it can.
+ */
+static void ov5647_frame_ctrls_work(struct work_struct *work)
+{
+	struct ov5647 *ov5647 = container_of(work, struct ov5647,
+					     frame_ctrls_work);
+	struct i2c_client *client = v4l2_get_subdevdata(&ov5647->sd);
+	const struct ov5647_frame_meta *m;
+	struct ov5647_ctrl_batch batch = { 0 };
+	struct ov5647_frame_ctrls *fc;
+	unsigned int n = 0;
+	u32 frame;
+
+	mutex_lock(&ov5647->mutex);
+	if (!ov5647->streaming || !ov5647->num_frame_ctrls || !ov5647->meta_count)
+		goto out_unlock;
+
+	frame = ov5647_meta_frame(ov5647, ktime_get_ns());
+	m = ov5647_meta_find(ov5647, frame + OV5647_GROUP_DELAY_FRAMES);
+	batch.val[OV5647_BATCH_EXPOSURE] = m->exposure;
+	batch.val[OV5647_BATCH_GAIN] = m->gain;
+	batch.val[OV5647_BATCH_VBLANK] = m->vts - ov5647->height;
+
+	while (n < ov5647->num_frame_ctrls) {
+		fc = &ov5647->frame_ctrls[n];
+		if (fc->sequence > frame + OV5647_GROUP_DELAY_FRAMES)
+			break;
+		if (fc->sequence < frame + OV5647_GROUP_DELAY_FRAMES)
+			dev_dbg(&client->dev, "controls for frame %u late, on %u\n",
+				fc->sequence, frame + OV5647_GROUP_DELAY_FRAMES);
+
+		if (fc->which & BIT(OV5647_BATCH_EXPOSURE))
+			batch.val[OV5647_BATCH_EXPOSURE] = fc->exposure;
+		if (fc->which & BIT(OV5647_BATCH_GAIN))
+			batch.val[OV5647_BATCH_GAIN] = fc->gain;
+		if (fc->which & BIT(OV5647_BATCH_VBLANK))
+			batch.val[OV5647_BATCH_VBLANK] = fc->vblank;
+		batch.dirty |= fc->which;
+		n++;
+	}
+
+	ov5647->num_frame_ctrls -= n;
+	memmove(ov5647->frame_ctrls, &ov5647->frame_ctrls[n],
+		ov5647->num_frame_ctrls * sizeof(*fc));
+
+	if (batch.dirty && pm_runtime_get_if_in_use(&client->dev) > 0) {
+		ov5647_apply_ctrls(ov5647, &batch);
+		pm_runtime_put(&client->dev);
+		/* The sensor no longer holds the control values */
+		ov5647->ctrls_stale = true;
+	}
+
+	ov5647_frame_ctrls_schedule(ov5647);
+
+out_unlock:
+	mutex_unlock(&ov5647->mutex);
+}
+
+/*
+ * Stable window of aec_stable around aec_target, in and out alike, and
+ * a fast zone widened where needed to contain it.
+ */
+static int ov5647_write_aec(struct ov5647 *ov5647)
+{
+	s32 half = ov5647->aec_stable->val / 2;
+	u8 wpt = clamp(ov5647->aec_target->val + half, 0, 255);
+	u8 bpt = clamp(ov5647->aec_target->val - half, 0, 255);
+	const struct ov5647_reg regs[] = {
+		{ OV5647_REG_AEC_WPT, wpt },
+		{ OV5647_REG_AEC_BPT, bpt },
+		{ OV5647_REG_AEC_VPT_HIGH, max_t(u8, ov5647->aec_fast_high->val, wpt) },
+		{ OV5647_REG_AEC_WPT2, wpt },
+		{ OV5647_REG_AEC_BPT2, bpt },
+		{ OV5647_REG_AEC_VPT_LOW, min_t(u8, ov5647->aec_fast_low->val, bpt) },
+	};
+
+	return ov5647_write_regs(ov5647, regs, ARRAY_SIZE(regs));
+}
+
+static int ov5647_write_banding(struct ov5647 *ov5647, s32 freq)
+{
+	int ret;
+
+	ret = ov5647_update_bits(ov5647, OV5647_REG_AEC_CTRL00, OV5647_AEC_BAND_EN,
+				 freq == V4L2_CID_POWER_LINE_FREQUENCY_DISABLED ?
+				 0 : OV5647_AEC_BAND_EN);
+	if (ret)
+		return ret;
+
+	if (freq == V4L2_CID_POWER_LINE_FREQUENCY_AUTO)
+		return ov5647_update_bits(ov5647, OV5647_REG_5060HZ_CTRL01,
+					  OV5647_5060HZ_MANUAL, 0);
+
+	ret = ov5647_update_bits(ov5647, OV5647_REG_5060HZ_CTRL01,
+				 OV5647_5060HZ_MANUAL, OV5647_5060HZ_MANUAL);
+	if (ret)
+		return ret;
+
+	return ov5647_update_bits(ov5647, OV5647_REG_5060HZ_CTRL00,
+				  OV5647_5060HZ_BAND50,
+				  freq == V4L2_CID_POWER_LINE_FREQUENCY_50HZ ?
+				  OV5647_5060HZ_BAND50 : 0);
+}
+
+/* Longest exposure a frame of height + vblank lines takes */
+static int ov5647_exposure_max(struct ov5647 *ov5647, s32 vblank)
+{
+	return ov5647->height + vblank - OV5647_EXPOSURE_MARGIN;
+}
+
+/* Bring the exposure range in line with the current frame length */
+static void ov5647_update_exposure_range(struct ov5647 *ov5647)
+{
+	int exposure_max = ov5647_exposure_max(ov5647, ov5647->vblank->cur.val);
+
+	__v4l2_ctrl_modify_range(ov5647->exposure, ov5647->exposure->minimum,
+				 exposure_max, ov5647->exposure->step,
+				 min_t(int, exposure_max, OV5647_EXPOSURE_DEFAULT));
+}
+
 static int set_ctrl(struct v4l2_ctrl *ctrl)
 {
 	struct ov5647 *ov5647 = container_of(ctrl->handler, struct ov5647, ctrl_handler);
 	struct i2c_client *client = v4l2_get_subdevdata(&ov5647->sd);
-	int ret;
+	struct v4l2_ctrl *exposure = ov5647->exposure;
+	struct ov5647_ctrl_batch batch;
+	int ret = 0;
 
-	if (ctrl->id == V4L2_CID_VBLANK) {
-		int exposure_max, exposure_def;
+	/*
+	 * Update max exposure while meeting expected vblanking. This is the
+	 * cluster's own s_ctrl, which __v4l2_ctrl_modify_range() would call
+	 * again, so move the bounds directly and clamp the new exposure before
+	 * it becomes current; the whole group goes out together below.
+	 */
+	if (ctrl == exposure && ov5647->vblank->is_new) {
+		exposure->maximum = ov5647_exposure_max(ov5647,
+							ov5647->vblank->val);
+		exposure->default_value = min_t(s64, exposure->maximum,
+						OV5647_EXPOSURE_DEFAULT);
+		exposure->val = min_t(s64, exposure->val, exposure->maximum);
+	}
 
-		/* Update max exposure while meeting expected vblanking */
-		exposure_max = ov5647->mode->height + ctrl->val - 4;
-		exposure_def = (exposure_max < OV5647_EXPOSURE_DEFAULT) ?
-			exposure_max : OV5647_EXPOSURE_DEFAULT;
-		__v4l2_ctrl_modify_range(ov5647->exposure,
-					 ov5647->exposure->minimum,
-					 exposure_max, ov5647->exposure->step,
-					 exposure_def);
+	/*
+	 * While streaming with async_ctrls, the cluster only records its
+	 * values; ov5647_ctrl_work() writes them without the caller waiting
+	 * on the bus.
+	 */
+	if (async_ctrls && ov5647->streaming && ctrl == ov5647->exposure) {
+		ov5647_batch_from_ctrls(ov5647, &batch);
+		memcpy(ov5647->ctrl_pending.val, batch.val, sizeof(batch.val));
+		ov5647->ctrl_pending.dirty |= batch.dirty;
+		queue_work(system_highpri_wq, &ov5647->ctrl_work);
+		trace_ov5647_ctrl(ctrl->id, ctrl->val, false, 0);
+		return 0;
 	}
 
 	/*
 	 * Applying V4L2 control value only happens
-	 * when power is up for streaming
+	 * when power is up for streaming. A negative return, runtime PM
+	 * disabled, is not a reference either.
 	 */
-	if (pm_runtime_get_if_in_use(&client->dev) == 0)
+	if (pm_runtime_get_if_in_use(&client->dev) <= 0) {
+		ov5647->ctrls_stale = true;
+		trace_ov5647_ctrl(ctrl->id, ctrl->val, false, 0);
 		return 0;
-	
-	switch (ctrl->id) {
-		case V4L2_CID_ANALOGUE_GAIN:
-			ret = ov5647_write_reg_8bit(ov5647, OV564_REG_ANALOG_GAIN0, 
-												(uint8_t)(ctrl->val & 0xff));
-			if (ret == 0) {
-				ret = ov5647_write_reg_8bit(ov5647, OV564_REG_ANALOG_GAIN1, 
-											(uint8_t)((ctrl->val >> 8) & 0x3));
-			} else {
-				ret = -EINVAL;
-			}
-			break;
-		case V4L2_CID_EXPOSURE: {
-			ret = ov5647_write_reg_8bit(ov5647, OV5647_REG_EXPOSURE0, (uint8_t)(ctrl->val & 0xff));
-			if (ret == 0) {
-				ret = ov5647_write_reg_8bit(ov5647, OV5647_REG_EXPOSURE1, 
-								(uint8_t)((ctrl->val >> 8) && 0xff));
-				if (ret == 0) {
-					ret = ov5647_write_reg_8bit(ov5647, OV5647_REG_EXPOSURE2, 
-							(uint8_t)((ctrl->val >> 16) && 0xf));
-				} else {
-					ret = -EINVAL;
-				}
-			} else {
-				ret = -EINVAL;
-			}
-			break;
-		}
-		case V4L2_CID_HFLIP: 
-			ret = ov5647_write_reg_8bit(ov5647, OV5647_REG_HOR_BIN_FLIP_MIR, !ctrl->val);
-			break;
-		
-		case V4L2_CID_VFLIP:
-			ret = ov5647_write_reg_8bit(ov5647, OV5647_REG_VER_BIN_FLIP_MIR, !ctrl->val);
-			break;
+	}
 
-		case V4L2_CID_VBLANK:
-			ret = ov5647_write_reg_8bit(ov5647, OV5647_REG_VTS_HI,
-												ov5647->mode->height + ctrl->val);
+	switch (ctrl->id) {
+		/* Cluster master: the whole batch goes out together */
+		case V4L2_CID_EXPOSURE:
+			ov5647_batch_from_ctrls(ov5647, &batch);
+			ret = ov5647_apply_ctrls(ov5647, &batch);
 			break;
 
 		case V4L2_CID_HBLANK:
 			break;
 
-		case V4L2_CID_AUTOGAIN: {
-			uint8_t reg;
-			ret = ov5647_read_reg_8bit(ov5647, OV5647_REG_MANUAL_CTRL, &reg);
-			if (ret == 0) {
-				ret = ov5647_write_reg_8bit(ov5647, OV5647_REG_MANUAL_CTRL, 
-						ctrl->val ? reg & ~BIT(1) : reg | BIT(1));
-			} else {
-				ret = -EINVAL;
-			}
+		/* Cluster master of the AEC thresholds */
+		case V4L2_CID_OV5647_AEC_TARGET:
+			ret = ov5647_write_aec(ov5647);
 			break;
-		}
 
-		case V4L2_CID_EXPOSURE_AUTO: {
-			uint8_t reg;
-			ret = ov5647_read_reg_8bit(ov5647, OV5647_REG_MANUAL_CTRL, &reg);
-			if (ret == 0) {
-				ret = ov5647_write_reg_8bit(ov5647, OV5647_REG_MANUAL_CTRL, 
-						ctrl->val == V4L2_EXPOSURE_MANUAL ? reg | BIT(0) : reg & ~BIT(0));
-			} else {
-				ret = -EINVAL;
-			}
+		case V4L2_CID_OV5647_AGC_CEILING:
+		{
+			const struct ov5647_reg regs[] = {
+				{ OV5647_REG_AEC_GAIN_CEIL_HI, (ctrl->val >> 8) & 0x03 },
+				{ OV5647_REG_AEC_GAIN_CEIL_LO, ctrl->val & 0xff },
+			};
+
+			ret = ov5647_write_regs(ov5647, regs, ARRAY_SIZE(regs));
 			break;
 		}
 
-		case V4L2_CID_AUTO_WHITE_BALANCE:
-			ret = ov5647_write_reg_8bit(ov5647, OV5647_REG_MIPI_AWB, ctrl->val ? 1 : 0);
+		case V4L2_CID_POWER_LINE_FREQUENCY:
+			ret = ov5647_write_banding(ov5647, ctrl->val);
 			break;
 
 		case V4L2_CID_PIXEL_RATE:
 			break;
 
+		/* Picked by the driver, the PLL goes out with the mode */
+		case V4L2_CID_LINK_FREQ:
+			break;
+
 		default:
 			dev_info(&client->dev,
 					"ctrl(id:0x%x,val:0x%x) is not handled\n",
@@ -1161,6 +2656,7 @@ static int set_ctrl(struct v4l2_ctrl *ctrl)
 	}
 
 	pm_runtime_put(&client->dev);
+	trace_ov5647_ctrl(ctrl->id, ctrl->val, true, ret);
 
 	return ret;
 }
@@ -1169,6 +2665,54 @@ static const struct v4l2_ctrl_ops _ctrl_ops = {
 	.s_ctrl = set_ctrl,
 };
 
+/* Levels are the 8-bit average luminance the AEC measures */
+static const struct v4l2_ctrl_config ov5647_aec_ctrls[] = {
+	{
+		.ops = &_ctrl_ops,
+		.id = V4L2_CID_OV5647_AEC_TARGET,
+		.name = "AEC Target Level",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.max = 255,
+		.step = 1,
+		.def = OV5647_AEC_TARGET_DEF,
+	}, {
+		.ops = &_ctrl_ops,
+		.id = V4L2_CID_OV5647_AEC_STABLE_RANGE,
+		.name = "AEC Stable Range",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.max = 255,
+		.step = 1,
+		.def = OV5647_AEC_STABLE_DEF,
+	}, {
+		.ops = &_ctrl_ops,
+		.id = V4L2_CID_OV5647_AEC_FAST_HIGH,
+		.name = "AEC Fast Zone High",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.max = 255,
+		.step = 1,
+		.def = OV5647_AEC_FAST_HIGH_DEF,
+	}, {
+		.ops = &_ctrl_ops,
+		.id = V4L2_CID_OV5647_AEC_FAST_LOW,
+		.name = "AEC Fast Zone Low",
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.max = 255,
+		.step = 1,
+		.def = OV5647_AEC_FAST_LOW_DEF,
+	},
+};
+
+static const struct v4l2_ctrl_config ov5647_agc_ceiling_ctrl = {
+	.ops = &_ctrl_ops,
+	.id = V4L2_CID_OV5647_AGC_CEILING,
+	.name = "AGC Gain Ceiling",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = OV564_ANA_GAIN_MIN,
+	.max = OV564_ANA_GAIN_MAX,
+	.step = OV564_ANA_GAIN_STEP,
+	.def = OV5647_AGC_CEILING_DEF,
+};
+
 /* Initialize control handlers */
 static int init_controls(struct ov5647 *ov5647)
 {
@@ -1180,26 +2724,28 @@ static int init_controls(struct ov5647 *ov5647)
 	int ret;
 
 	ctrl_hdlr = &ov5647->ctrl_handler;
-	ret = v4l2_ctrl_handler_init(ctrl_hdlr, 12);
+	ret = v4l2_ctrl_handler_init(ctrl_hdlr, 18);
 	if (ret)
 		return ret;
 
-	printk("init_controls:: mutex_init ");
 	mutex_init(&ov5647->mutex);
 	ctrl_hdlr->lock = &ov5647->mutex;
 
 	/* By default, PIXEL_RATE is read only */
 	ov5647->pixel_rate = 
 		v4l2_ctrl_new_std(ctrl_hdlr, &_ctrl_ops,
-			V4L2_CID_PIXEL_RATE, ov5647->mode->pixel_rate, 
-			ov5647->mode->pixel_rate, 1, ov5647->mode->pixel_rate);
+			V4L2_CID_PIXEL_RATE, ov5647_pixel_rate(ov5647),
+			ov5647_pixel_rate(ov5647), 1, ov5647_pixel_rate(ov5647));
 
+	/* Chosen per mode and frame rate among what the device tree allows */
 	ov5647->link_freq =
 		v4l2_ctrl_new_int_menu(ctrl_hdlr, &_ctrl_ops, V4L2_CID_LINK_FREQ,
-				       ARRAY_SIZE(ov5647_link_freq_menu) - 1, 0,
-				       ov5647_link_freq_menu);
-	if (ov5647->link_freq)
+				       ARRAY_SIZE(ov5647_link_freq_menu) - 1,
+				       ov5647->link_idx, ov5647_link_freq_menu);
+	if (ov5647->link_freq) {
 		ov5647->link_freq->flags |= V4L2_CTRL_FLAG_READ_ONLY;
+		ov5647->link_freq->menu_skip_mask = ~ov5647->link_freq_mask;
+	}
 
 	/* Initial vblank/hblank/exposure parameters based on current mode */
 	ov5647->vblank = v4l2_ctrl_new_std(ctrl_hdlr, &_ctrl_ops,
@@ -1212,16 +2758,17 @@ static int init_controls(struct ov5647 *ov5647)
 					   V4L2_CID_HBLANK, hblank, hblank,
 					   1, hblank);
 
-	exposure_max = ov5647->mode->vts_def - 4;
-	exposure_def = (exposure_max < OV5647_EXPOSURE_DEFAULT) ?
-							exposure_max : OV5647_EXPOSURE_DEFAULT;
+	/* Exposure fits the default frame length */
+	exposure_max = ov5647->mode->vts_def - OV5647_EXPOSURE_MARGIN;
+	exposure_def = min_t(int, ov5647->mode->vts_def - OV5647_EXPOSURE_MARGIN,
+			     OV5647_EXPOSURE_DEFAULT);
 	ov5647->exposure = v4l2_ctrl_new_std(ctrl_hdlr, &_ctrl_ops, V4L2_CID_EXPOSURE,
 					     OV5647_EXPOSURE_MIN, exposure_max,
 					     OV5647_EXPOSURE_STEP, exposure_def);
 						
-	v4l2_ctrl_new_std(ctrl_hdlr, &_ctrl_ops, V4L2_CID_ANALOGUE_GAIN,
-			  OV564_ANA_GAIN_MIN, OV564_ANA_GAIN_MAX,
-			  OV564_ANA_GAIN_STEP, OV564_ANA_GAIN_DEFAULT);
+	ov5647->gain = v4l2_ctrl_new_std(ctrl_hdlr, &_ctrl_ops, V4L2_CID_ANALOGUE_GAIN,
+					 OV564_ANA_GAIN_MIN, OV564_ANA_GAIN_MAX,
+					 OV564_ANA_GAIN_STEP, OV564_ANA_GAIN_DEFAULT);
 	
 	// DIGITAL GAIN TODO
 
@@ -1235,15 +2782,28 @@ static int init_controls(struct ov5647 *ov5647)
 	if (ov5647->vflip)
 		ov5647->vflip->flags |= V4L2_CTRL_FLAG_MODIFY_LAYOUT;
 
-	v4l2_ctrl_new_std(ctrl_hdlr, &_ctrl_ops,
-			  V4L2_CID_AUTOGAIN, 0, 1, 1, 0);
+	ov5647->autogain = v4l2_ctrl_new_std(ctrl_hdlr, &_ctrl_ops,
+					     V4L2_CID_AUTOGAIN, 0, 1, 1, 0);
+
+	ov5647->awb = v4l2_ctrl_new_std(ctrl_hdlr, &_ctrl_ops,
+					V4L2_CID_AUTO_WHITE_BALANCE, 0, 1, 1, 0);
+
+	ov5647->exposure_auto =
+		v4l2_ctrl_new_std_menu(ctrl_hdlr, &_ctrl_ops,
+				       V4L2_CID_EXPOSURE_AUTO, V4L2_EXPOSURE_MANUAL,
+				       0, V4L2_EXPOSURE_MANUAL);
 
-	v4l2_ctrl_new_std(ctrl_hdlr, &_ctrl_ops,
-			  V4L2_CID_AUTO_WHITE_BALANCE, 0, 1, 1, 0);
+	/* Tuning of the on-sensor loop the two controls above hand over to */
+	ov5647->aec_target = v4l2_ctrl_new_custom(ctrl_hdlr, &ov5647_aec_ctrls[0], NULL);
+	ov5647->aec_stable = v4l2_ctrl_new_custom(ctrl_hdlr, &ov5647_aec_ctrls[1], NULL);
+	ov5647->aec_fast_high = v4l2_ctrl_new_custom(ctrl_hdlr, &ov5647_aec_ctrls[2], NULL);
+	ov5647->aec_fast_low = v4l2_ctrl_new_custom(ctrl_hdlr, &ov5647_aec_ctrls[3], NULL);
+	v4l2_ctrl_new_custom(ctrl_hdlr, &ov5647_agc_ceiling_ctrl, NULL);
 
-	v4l2_ctrl_new_std_menu(ctrl_hdlr, &_ctrl_ops,
-			       V4L2_CID_EXPOSURE_AUTO, V4L2_EXPOSURE_MANUAL,
-			       0, V4L2_EXPOSURE_MANUAL);
+	/* The common table leaves manual 60Hz banding on */
+	v4l2_ctrl_new_std_menu(ctrl_hdlr, &_ctrl_ops, V4L2_CID_POWER_LINE_FREQUENCY,
+			       V4L2_CID_POWER_LINE_FREQUENCY_AUTO, 0,
+			       V4L2_CID_POWER_LINE_FREQUENCY_60HZ);
 
 	// TEST PATTERNS TODO
 
@@ -1254,6 +2814,19 @@ static int init_controls(struct ov5647 *ov5647)
 		goto error;
 	}
 
+	/* One S_EXT_CTRLS call, one PM reference, one register batch */
+	v4l2_ctrl_cluster(OV5647_BATCH_NUM, &ov5647->exposure);
+	BUILD_BUG_ON(BIT(OV5647_BATCH_EXPOSURE) != OV5647_CTRL_EXPOSURE);
+	BUILD_BUG_ON(BIT(OV5647_BATCH_GAIN) != OV5647_CTRL_GAIN);
+	BUILD_BUG_ON(BIT(OV5647_BATCH_VBLANK) != OV5647_CTRL_VBLANK);
+	BUILD_BUG_ON(BIT(OV5647_BATCH_AUTOGAIN) != OV5647_CTRL_AUTOGAIN);
+	BUILD_BUG_ON(BIT(OV5647_BATCH_EXPOSURE_AUTO) !=
+		     OV5647_CTRL_EXPOSURE_AUTO);
+	BUILD_BUG_ON(BIT(OV5647_BATCH_AWB) != OV5647_CTRL_AWB);
+	BUILD_BUG_ON(BIT(OV5647_BATCH_VFLIP) != OV5647_CTRL_VFLIP);
+	BUILD_BUG_ON(BIT(OV5647_BATCH_HFLIP) != OV5647_CTRL_HFLIP);
+	v4l2_ctrl_cluster(4, &ov5647->aec_target);
+
 	ret = v4l2_fwnode_device_parse(&client->dev, &props);
 	if (ret)
 		goto error;
@@ -1282,23 +2855,14 @@ static int enum_mbus_code(struct v4l2_subdev *sd,
 				 struct v4l2_subdev_mbus_code_enum *code)
 {
 	struct ov5647 *ov5647 = to_ov5647(sd);
-	printk("ov5647 :: enum_mbus_code");
 
-	if (code->index > 0) {
-		printk("ov5647 :: enum_mbus_code - code->index > 0");
+	if (code->index >= ARRAY_SIZE(ov5647_mbus_codes))
 		return -EINVAL;
-	}
 
-	if (code->pad == 0) { //IMAGE_PAD
-		printk("ov5647 :: enum_mbus_code - code->pad == 0");
-		mutex_lock(&ov5647->mutex);
-		code->code = MEDIA_BUS_FMT_SBGGR10_1X10;
-		mutex_unlock(&ov5647->mutex);
-	} else {
-		printk("ov5647 :: enum_mbus_code - code->pad != 0");
-		return -EINVAL;
-	}
-	printk("ov5647 :: enum_mbus_code - return 0");
+	mutex_lock(&ov5647->mutex);
+	code->code = ov5647_mbus_codes[code->index];
+	mutex_unlock(&ov5647->mutex);
+
 	return 0;
 }
 
@@ -1321,46 +2885,394 @@ static void _update_image_pad_format( const struct ov5647_mode *mode,
 	_reset_colorspace(&fmt->format);
 }
 
-static int _get_pad_format(struct ov5647 *ov5647,
-				   struct v4l2_subdev_state *sd_state,
-				   struct v4l2_subdev_format *fmt)
-{
-	struct v4l2_mbus_framefmt *try_fmt;
-	if (fmt->which == V4L2_SUBDEV_FORMAT_TRY) {
-		printk("ov5647 :: get_pad_format");
-		try_fmt = v4l2_subdev_get_try_format(&ov5647->sd, sd_state, fmt->pad);
-		/* update the code which could change due to vflip or hflip: */
-		try_fmt->code = fmt->pad == 0 ? 
-				MEDIA_BUS_FMT_SRGGB10_1X10 :
-				MEDIA_BUS_FMT_SENSOR_DATA;
-		fmt->format = *try_fmt;
-	} else {
-		if (fmt->pad == 0) {
-			_update_image_pad_format(ov5647->mode, fmt);
-			fmt->format.code = MEDIA_BUS_FMT_SRGGB10_1X10;
-		} else {
-			printk("ov5647 :: _get_pad_format - fmt->pad != 0");
-			return -EINVAL;
-		}
+static int _get_pad_format(struct ov5647 *ov5647,
+				   struct v4l2_subdev_state *sd_state,
+				   struct v4l2_subdev_format *fmt)
+{
+	struct v4l2_mbus_framefmt *try_fmt;
+	if (fmt->which == V4L2_SUBDEV_FORMAT_TRY) {
+		try_fmt = v4l2_subdev_get_try_format(&ov5647->sd, sd_state, fmt->pad);
+		fmt->format = *try_fmt;
+	} else {
+		_update_image_pad_format(ov5647->mode, fmt);
+		fmt->format.width = ov5647->width;
+		fmt->format.height = ov5647->height;
+		fmt->format.code = ov5647->fmt.code;
+	}
+	return 0;
+}
+
+static int get_pad_format(struct v4l2_subdev *sd,
+				   struct v4l2_subdev_state *sd_state,
+				   struct v4l2_subdev_format *fmt)
+{
+	struct ov5647 *ov5647 = to_ov5647(sd);
+	int ret = 0;
+
+
+	mutex_lock(&ov5647->mutex);
+	ret = _get_pad_format(ov5647, sd_state, fmt);
+	mutex_unlock(&ov5647->mutex);
+
+	return ret;
+}
+
+/* Same-size modes differ only in speed: keep the active one if it fits */
+static const struct ov5647_mode *ov5647_find_mode(struct ov5647 *ov5647,
+						  u32 width, u32 height)
+{
+	const struct ov5647_mode *mode;
+
+	mode = v4l2_find_nearest_size(supported_modes,
+				      ARRAY_SIZE(supported_modes),
+				      width, height, width, height);
+	if (ov5647->mode->width == mode->width &&
+	    ov5647->mode->height == mode->height)
+		return ov5647->mode;
+
+	return mode;
+}
+
+/* Report the active link configuration and the pixel rate it gives */
+static void ov5647_update_link_ctrls(struct ov5647 *ov5647)
+{
+	u64 rate = ov5647_pixel_rate(ov5647);
+
+	__v4l2_ctrl_s_ctrl(ov5647->link_freq, ov5647->link_idx);
+	__v4l2_ctrl_modify_range(ov5647->pixel_rate, rate, rate, 1, rate);
+}
+
+/*
+ * Link configuration a mode runs at unless a frame rate asks for less:
+ * its own when the device tree allows it, else the fastest allowed one
+ * below it, else the slowest allowed one above it.
+ */
+static unsigned int ov5647_mode_link(struct ov5647 *ov5647,
+				     const struct ov5647_mode *mode)
+{
+	unsigned long below;
+	unsigned int own, link;
+
+	for (own = 0; own < ARRAY_SIZE(ov5647_link_freq_menu) - 1; own++)
+		if (ov5647_link_freq_menu[own] >= mode->link_freq)
+			break;
+
+	below = ov5647->link_freq_mask & GENMASK(own, 0);
+	link = find_last_bit(&below, ARRAY_SIZE(ov5647_link_freq_menu));
+	if (link < ARRAY_SIZE(ov5647_link_freq_menu))
+		return link;
+
+	return find_first_bit(&ov5647->link_freq_mask,
+			      ARRAY_SIZE(ov5647_link_freq_menu));
+}
+
+/*
+ * Fastest pixel rate a mode runs at in bpp bits with the links the device
+ * tree allows
+ */
+static u64 ov5647_mode_rate(struct ov5647 *ov5647,
+			    const struct ov5647_mode *mode, unsigned int bpp)
+{
+	return OV5647_PIXEL_RATE_LANES(ov5647_link_pll_mult[ov5647_mode_link(ov5647, mode)],
+				       bpp, ov5647->lanes);
+}
+
+/*
+ * Slowest allowed link configuration, no faster than the mode's own, that
+ * still has room for a frame of height lines in interval.
+ */
+static unsigned int ov5647_link_for_interval(struct ov5647 *ov5647,
+					     const struct ov5647_mode *mode,
+					     unsigned int height,
+					     const struct v4l2_fract *interval)
+{
+	unsigned int max = ov5647_mode_link(ov5647, mode);
+	unsigned int link;
+	u64 vts;
+
+	if (!interval->numerator || !interval->denominator)
+		return max;
+
+	for_each_set_bit(link, &ov5647->link_freq_mask, max) {
+		vts = DIV_ROUND_CLOSEST_ULL(OV5647_PIXEL_RATE_LANES(ov5647_link_pll_mult[link],
+								    ov5647_bpp(ov5647),
+								    ov5647->lanes) *
+					    interval->numerator,
+					    (u64)mode->hts_def * interval->denominator);
+		if (vts >= height + OV5647_VBLANK_MIN)
+			return link;
+	}
+
+	return max;
+}
+
+/*
+ * Bring the geometry dependent controls in line with the active output size.
+ * The frame length goes back to the mode default, so a region of interest
+ * keeps the mode's frame rate. The VBLANK range and the exposure range
+ * follow its height.
+ */
+static void ov5647_update_limits(struct ov5647 *ov5647)
+{
+	const struct ov5647_mode *mode = ov5647->mode;
+	unsigned int height = ov5647->height;
+	int hblank, vblank_def;
+
+	/* Update limits and set FPS to default */
+	vblank_def = max_t(int, mode->vts_def - height, OV5647_VBLANK_MIN);
+	__v4l2_ctrl_modify_range(ov5647->vblank, OV5647_VBLANK_MIN,
+							OV5647_VTS_MAX - height, 1, 
+							vblank_def);
+	__v4l2_ctrl_s_ctrl(ov5647->vblank, vblank_def);
+
+	hblank = mode->hts_def - ov5647->width;
+	__v4l2_ctrl_modify_range(ov5647->hblank, hblank, hblank, 1, hblank);
+	__v4l2_ctrl_s_ctrl(ov5647->hblank, hblank);
+
+	/* Exposure fits the frame of this output height and vblank */
+	ov5647_update_exposure_range(ov5647);
+
+	ov5647_update_link_ctrls(ov5647);
+}
+
+/* Read out the mode's whole field of view, binned and skipped as it says */
+static void ov5647_reset_roi(struct ov5647 *ov5647)
+{
+	const struct ov5647_mode *mode = ov5647->mode;
+
+	ov5647->crop = mode->crop;
+	ov5647->width = mode->width;
+	ov5647->height = mode->height;
+	ov5647->binning = mode->binning;
+	ov5647->skip_x = mode->crop.width / mode->width;
+	ov5647->skip_y = mode->crop.height / mode->height;
+}
+
+/* Make mode active and bring the mode dependent controls along */
+static void ov5647_update_mode(struct ov5647 *ov5647,
+			       const struct ov5647_mode *mode)
+{
+	ov5647->mode = mode;
+	ov5647->link_idx = ov5647_mode_link(ov5647, mode);
+	ov5647_reset_roi(ov5647);
+	ov5647_update_limits(ov5647);
+}
+
+/*
+ * Fit a region of interest to the active mode: inside the mode's crop, a
+ * whole number of even output lines/columns after skipping, Bayer aligned,
+ * and with the window padding still inside the native array.
+ */
+static void ov5647_adjust_roi(const struct ov5647_mode *mode,
+			      struct v4l2_rect *r)
+{
+	unsigned int skip_x = mode->crop.width / mode->width;
+	unsigned int skip_y = mode->crop.height / mode->height;
+	int left_max, top_max;
+
+	r->width = clamp_t(u32, round_down(r->width, 2 * skip_x),
+			   OV5647_ROI_MIN_WIDTH * skip_x, mode->width * skip_x);
+	r->height = clamp_t(u32, round_down(r->height, 2 * skip_y),
+			    OV5647_ROI_MIN_HEIGHT * skip_y, mode->height * skip_y);
+
+	left_max = min_t(int, mode->crop.left + mode->crop.width - r->width,
+			 OV5647_NATIVE_WIDTH + OV5647_PIXEL_ARRAY_LEFT -
+			 r->width - mode->win_pad_x);
+	top_max = min_t(int, mode->crop.top + mode->crop.height - r->height,
+			OV5647_NATIVE_HEIGHT + OV5647_PIXEL_ARRAY_TOP -
+			r->height - mode->win_pad_y);
+	r->left = clamp_t(int, r->left, mode->crop.left, left_max) & ~1;
+	r->top = clamp_t(int, r->top, mode->crop.top, top_max) & ~1;
+}
+
+/*
+ * A size no mode has is read out from the widest field of view mode whose
+ * skip factor still leaves room for it: a window skip times the size,
+ * centred in that mode's crop and then binned or skipped down by the
+ * sensor. The mode supplies PLL, HTS and binning, so pixel rate and the
+ * blanking limits follow it, and the crop reported is the window actually
+ * read.
+ */
+static const struct ov5647_mode *ov5647_scale_mode(u32 width, u32 height,
+						   struct v4l2_rect *crop)
+{
+	const struct ov5647_mode *mode, *best = NULL;
+	unsigned int skip, best_skip = 0;
+
+	for (mode = supported_modes;
+	     mode < supported_modes + ARRAY_SIZE(supported_modes); mode++) {
+		skip = mode->crop.width / mode->width;
+		if (skip != mode->crop.height / mode->height ||
+		    width * skip > mode->crop.width ||
+		    height * skip > mode->crop.height)
+			continue;
+
+		if (skip > best_skip ||
+		    (skip == best_skip &&
+		     mode->crop.width * mode->crop.height >
+		     best->crop.width * best->crop.height)) {
+			best = mode;
+			best_skip = skip;
+		}
+	}
+
+	crop->width = width * best_skip;
+	crop->height = height * best_skip;
+	crop->left = best->crop.left + (best->crop.width - crop->width) / 2;
+	crop->top = best->crop.top + (best->crop.height - crop->height) / 2;
+	ov5647_adjust_roi(best, crop);
+
+	return best;
+}
+
+/* Drop the preset's value of a register the generator computes */
+static bool ov5647_gen_overrides(const struct ov5647_reg *regs, unsigned int n,
+				 uint16_t addr)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		if (regs[i].address == addr)
+			return true;
+
+	return false;
+}
+
+/*
+ * Mode generator: build a mode for width x height at fps and bpp bits per
+ * pixel over lanes data lanes. The preset with the largest fitting skip factor is the seed (see
+ * ov5647_scale_mode()); its analog and ISP settings are kept and the
+ * generator computes on top of them:
+ *  - window and output size, centred, with the seed's binning and skip
+ *  - HTS: the seed's horizontal blanking, no shorter than OV5647_HTS_MIN
+ *  - the slowest allowed link configuration that sustains fps at the
+ *    shortest frame, and the VTS that gives fps at its pixel rate
+ *  - the MIPI pixel clock period and the 50Hz/60Hz banding steps
+ * The presets are the engine's fixed points: the hand-tuned tables for the
+ * sizes they cover. Registers go to regs[], which must hold
+ * OV5647_GEN_MAX_REGS entries.
+ */
+static int ov5647_gen_mode(u32 width, u32 height, unsigned int fps,
+			   unsigned int bpp, unsigned int lanes,
+			   unsigned long link_mask, struct ov5647_mode *mode,
+			   struct ov5647_reg *regs)
+{
+	const struct ov5647_mode *seed;
+	const struct ov5647_reg_list *seed_regs;
+	struct v4l2_rect crop;
+	unsigned int skip, link, i, n = 0;
+	u32 hts, vts, vts_min, x_start, y_start, x_end, y_end;
+	u64 rate, need;
+
+	if (bpp != 8 && bpp != 10)
+		return -EINVAL;
+	if (!fps)
+		fps = OV5647_GEN_DEFAULT_FPS;
+
+	seed = ov5647_scale_mode(width, height, &crop);
+	seed_regs = &seed->reg_list;
+	skip = seed->crop.width / seed->width;
+	width = crop.width / skip;
+	height = crop.height / skip;
+
+	hts = max_t(u32, width + seed->hts_def - seed->width, OV5647_HTS_MIN);
+	vts_min = height + OV5647_VBLANK_MIN;
+
+	/*
+	 * Slowest allowed link configuration that reaches fps at the shortest
+	 * frame, or the fastest allowed one if none does.
+	 */
+	need = (u64)hts * vts_min * fps;
+	for_each_set_bit(link, &link_mask, ARRAY_SIZE(ov5647_link_pll_mult))
+		if (OV5647_PIXEL_RATE_LANES(ov5647_link_pll_mult[link], bpp,
+					    lanes) >= need)
+			break;
+	if (link >= ARRAY_SIZE(ov5647_link_pll_mult))
+		link = find_last_bit(&link_mask, ARRAY_SIZE(ov5647_link_pll_mult));
+	if (link >= ARRAY_SIZE(ov5647_link_pll_mult))
+		return -EINVAL;
+	rate = OV5647_PIXEL_RATE_LANES(ov5647_link_pll_mult[link], bpp, lanes);
+
+	vts = clamp_t(u64, div_u64(rate, (u64)hts * fps), vts_min,
+		      OV5647_VTS_MAX);
+
+	x_start = crop.left - OV5647_PIXEL_ARRAY_LEFT;
+	y_start = crop.top - OV5647_PIXEL_ARRAY_TOP;
+	x_end = x_start + crop.width + seed->win_pad_x - 1;
+	y_end = y_start + crop.height + seed->win_pad_y - 1;
+
+	{
+		const struct ov5647_reg gen[] = {
+			{ OV5647_REG_PLL_CTRL0, bpp == 8 ? OV5647_PLL_CTRL0_MIPI8 :
+							   OV5647_PLL_CTRL0_MIPI10 },
+			{ OV5647_REG_PLL_MULT, ov5647_link_pll_mult[link] },
+			OV5647_REG16(OV5647_REG_X_ADDR_START_HIGH, x_start),
+			OV5647_REG16(OV5647_REG_Y_ADDR_START_HIGH, y_start),
+			OV5647_REG16(OV5647_REG_X_ADDR_END_HIGH, x_end),
+			OV5647_REG16(OV5647_REG_Y_ADDR_END_HIGH, y_end),
+			OV5647_REG16(OV5647_REG_X_OUTPUT_SIZE_HIGH, width),
+			OV5647_REG16(OV5647_REG_Y_OUTPUT_SIZE_HIGH, height),
+			OV5647_REG16(OV5647_REG_HTS_HI, hts),
+			OV5647_REG16(OV5647_REG_VTS_HI, vts),
+		};
+		struct ov5647_reg timing[OV5647_TIMING_REGS];
+
+		if (seed_regs->num_of_regs + ARRAY_SIZE(gen) +
+		    OV5647_TIMING_REGS > OV5647_GEN_MAX_REGS)
+			return -E2BIG;
+
+		ov5647_timing_regs(link, bpp, lanes, hts, vts, timing);
+		for (i = 0; i < seed_regs->num_of_regs; i++)
+			if (!ov5647_gen_overrides(gen, ARRAY_SIZE(gen),
+						  seed_regs->regs[i].address) &&
+			    !ov5647_gen_overrides(timing, OV5647_TIMING_REGS,
+						  seed_regs->regs[i].address))
+				regs[n++] = seed_regs->regs[i];
+		memcpy(&regs[n], gen, sizeof(gen));
+		n += ARRAY_SIZE(gen);
+		memcpy(&regs[n], timing, sizeof(timing));
+		n += OV5647_TIMING_REGS;
 	}
+
+	*mode = *seed;
+	mode->width = width;
+	mode->height = height;
+	mode->crop = crop;
+	mode->pixel_rate = rate;
+	mode->link_freq = ov5647_link_freq_menu[link];
+	mode->hts_def = hts;
+	mode->vts_def = vts;
+	mode->reg_list.num_of_regs = n;
+	mode->reg_list.regs = regs;
+
 	return 0;
 }
 
-static int get_pad_format(struct v4l2_subdev *sd,
-				   struct v4l2_subdev_state *sd_state,
-				   struct v4l2_subdev_format *fmt)
+/*
+ * Generate the active mode. The sensor may still hold the previous
+ * generated mode under the same pointer, so that must be reloaded in full.
+ */
+static int ov5647_use_gen_mode(struct ov5647 *ov5647, u32 width, u32 height,
+			       unsigned int fps)
 {
-	struct ov5647 *ov5647 = to_ov5647(sd);
-	int ret = 0;
+	struct i2c_client *client = v4l2_get_subdevdata(&ov5647->sd);
+	int ret;
 
-	printk("ov5647 :: get_pad_format");
+	ret = ov5647_gen_mode(width, height, fps, ov5647_bpp(ov5647),
+			      ov5647->lanes, ov5647->link_freq_mask,
+			      &ov5647->gen_mode, ov5647->gen_regs);
+	if (ret)
+		return ret;
 
-	mutex_lock(&ov5647->mutex);
-	ret = _get_pad_format(ov5647, sd_state, fmt);
-	mutex_unlock(&ov5647->mutex);
+	if (ov5647->loaded_mode == &ov5647->gen_mode)
+		ov5647->loaded_mode = NULL;
 
-	printk("ov5647 :: get_pad_format : %d", ret );
-	return ret;
+	dev_dbg(&client->dev, "generated %ux%u@%u: pixel rate %llu link %llu\n",
+		ov5647->gen_mode.width, ov5647->gen_mode.height, fps,
+		ov5647->gen_mode.pixel_rate, ov5647->gen_mode.link_freq);
+
+	ov5647_update_mode(ov5647, &ov5647->gen_mode);
+	return 0;
 }
 
 static int set_pad_format(struct v4l2_subdev *sd,
@@ -1370,64 +3282,71 @@ static int set_pad_format(struct v4l2_subdev *sd,
 	struct ov5647 *ov5647 = to_ov5647(sd);
 	const struct ov5647_mode *mode;
 	struct v4l2_mbus_framefmt *framefmt;
-	int exposure_max, exposure_def, hblank;
+	struct v4l2_rect crop;
+	u32 width, height;
+	bool gen;
+	int ret = 0;
 
-	printk("ov5647 :: set_pad_format");
 	mutex_lock(&ov5647->mutex);
 
-	if (fmt->pad == 0) {
-		fmt->format.code = MEDIA_BUS_FMT_SBGGR10_1X10;
-		mode = v4l2_find_nearest_size(supported_modes,
-					ARRAY_SIZE(supported_modes),
-					width, height,
-					fmt->format.width,
-					fmt->format.height);
-		_update_image_pad_format(mode, fmt);
-		if (fmt->which == V4L2_SUBDEV_FORMAT_TRY) {
-			printk("ov5647 :: set_pad_format - V4L2_SUBDEV_FORMAT_TRY");
-			framefmt = v4l2_subdev_get_try_format(sd, sd_state, fmt->pad);
-			*framefmt = fmt->format;
-		} else if (ov5647->mode != mode || ov5647->fmt.code != fmt->format.code) {
-			printk("ov5647 :: set_pad_format - ov5647->mode != mode || ov5647->fmt.code != fmt->format.code");
-			ov5647->fmt = fmt->format;
-			ov5647->mode = mode;
-
-			/* Update limits and set FPS to default */
-			__v4l2_ctrl_modify_range(ov5647->vblank, OV5647_VBLANK_MIN,
-									OV5647_VTS_MAX - mode->height, 1, 
-									mode->vts_def - mode->height);
-			__v4l2_ctrl_s_ctrl(ov5647->vblank, mode->vts_def - mode->height);
-
-			hblank = mode->hts_def - mode->width;
-			__v4l2_ctrl_modify_range(ov5647->hblank, hblank, hblank, 1, hblank);
-			__v4l2_ctrl_s_ctrl(ov5647->hblank, hblank);
-
-			/* Update max exposure while meeting expected vblanking */
-			exposure_max = mode->vts_def - 4;
-			exposure_def = (exposure_max < OV5647_EXPOSURE_DEFAULT) ?
-								exposure_max : OV5647_EXPOSURE_DEFAULT;
-			__v4l2_ctrl_modify_range(ov5647->exposure, ov5647->exposure->minimum,
-						 exposure_max, ov5647->exposure->step, exposure_def);
-
-			/* Scale the pixel rate based on the mode specific factor */
-			__v4l2_ctrl_modify_range(ov5647->pixel_rate, ov5647->mode->pixel_rate,
-								ov5647->mode->pixel_rate, 1, ov5647->mode->pixel_rate);
-		}
+	if (!ov5647_code_supported(fmt->format.code))
+		fmt->format.code = ov5647_mbus_codes[0];
+
+	width = clamp_t(u32, round_down(fmt->format.width, 2),
+			OV5647_ROI_MIN_WIDTH, OV5647_PIXEL_ARRAY_WIDTH);
+	height = clamp_t(u32, round_down(fmt->format.height, 2),
+			 OV5647_ROI_MIN_HEIGHT, OV5647_PIXEL_ARRAY_HEIGHT);
+
+	if (fmt->which == V4L2_SUBDEV_FORMAT_ACTIVE &&
+	    fmt->format.code == ov5647->fmt.code &&
+	    width == ov5647->width && height == ov5647->height) {
+		/* Already the output of the active region of interest */
+		_update_image_pad_format(ov5647->mode, fmt);
+		fmt->format.width = ov5647->width;
+		fmt->format.height = ov5647->height;
+		mutex_unlock(&ov5647->mutex);
+		return 0;
+	}
+
+	/* A size no preset has, or a link it isn't written for, gets a generated mode */
+	mode = ov5647_find_mode(ov5647, width, height);
+	gen = mode->width != width || mode->height != height ||
+	      !ov5647_mode_carried(ov5647, mode);
+	if (gen) {
+		mode = ov5647_scale_mode(width, height, &crop);
+		width = crop.width / (mode->crop.width / mode->width);
+		height = crop.height / (mode->crop.height / mode->height);
 	} else {
-		printk("ov5647 :: set_pad_format - pad != 0");
-		if (fmt->which == V4L2_SUBDEV_FORMAT_TRY) {
-			framefmt = v4l2_subdev_get_try_format(sd, sd_state,
-							      fmt->pad);
-			*framefmt = fmt->format;
-		} else {
-			printk("ov5647 :: set_pad_format - fmt which is not format try");
-			return -EINVAL;
-		}
+		crop = mode->crop;
+	}
+
+	_update_image_pad_format(mode, fmt);
+	fmt->format.width = width;
+	fmt->format.height = height;
+	if (fmt->which == V4L2_SUBDEV_FORMAT_TRY) {
+		framefmt = v4l2_subdev_get_try_format(sd, sd_state, fmt->pad);
+		*framefmt = fmt->format;
+		*v4l2_subdev_get_try_crop(sd, sd_state, fmt->pad) = crop;
+	} else if (ov5647->streaming) {
+		/*
+		 * The active output was matched above, so this is another
+		 * size or bit depth: the PLL, binning/skipping and window
+		 * are only written at stream on, and the frame timer
+		 * works from the timing they give.
+		 */
+		ret = -EBUSY;
+	} else if (gen) {
+		ov5647->fmt = fmt->format;
+		ret = ov5647_use_gen_mode(ov5647, width, height,
+					  OV5647_GEN_DEFAULT_FPS);
+	} else {
+		/* Also drops a region of interest set on the same mode */
+		ov5647->fmt = fmt->format;
+		ov5647_update_mode(ov5647, mode);
 	}
 
 	mutex_unlock(&ov5647->mutex);
-	printk("ov5647 :: set_pad_format : 0");
-	return 0;
+	return ret;
 }
 
 static const struct v4l2_rect *_get_pad_crop(struct ov5647 *ov5647,
@@ -1438,7 +3357,7 @@ static const struct v4l2_rect *_get_pad_crop(struct ov5647 *ov5647,
 		case V4L2_SUBDEV_FORMAT_TRY:
 			return v4l2_subdev_get_try_crop(&ov5647->sd, sd_state, pad);
 		case V4L2_SUBDEV_FORMAT_ACTIVE:
-			return &ov5647->mode->crop;
+			return &ov5647->crop;
 	}
 
 	return NULL;
@@ -1449,87 +3368,496 @@ static int get_selection(struct v4l2_subdev *sd,
 				struct v4l2_subdev_selection *sel)
 {
 	struct ov5647 *ov5647;
-	printk("ov5647 :: get_selection");
 
 	switch (sel->target) {
 		case V4L2_SEL_TGT_CROP: {
-			printk("ov5647 :: get_selection - V4L2_SEL_TGT_CROP, attempting to lock");
 			ov5647 = to_ov5647(sd);
 			mutex_lock(&ov5647->mutex);
 			sel->r = *_get_pad_crop(ov5647, sd_state, sel->pad, sel->which);
 			mutex_unlock(&ov5647->mutex);
-			printk("ov5647 :: get_selection - V4L2_SEL_TGT_CROP, unlocked | sel rect width : %d", sel->r.width);
-			printk("ov5647 :: get_selection - return 0");
 			return 0;
 		}
 
 		case V4L2_SEL_TGT_NATIVE_SIZE:
-			printk("ov5647 :: get_selection - V4L2_SEL_TGT_NATIVE_SIZE");
 			sel->r.top = 0;
 			sel->r.left = 0;
 			sel->r.width = OV5647_NATIVE_WIDTH;
 			sel->r.height = OV5647_NATIVE_HEIGHT;
-			printk("ov5647 :: get_selection - return 0");
 			return 0;
 
 		case V4L2_SEL_TGT_CROP_DEFAULT:
 		case V4L2_SEL_TGT_CROP_BOUNDS:
-			printk("ov5647 :: get_selection - V4L2_SEL_TGT_CROP_DEFAULT or V4L2_SEL_TGT_CROP_BOUNDS");
 			sel->r.top = OV5647_PIXEL_ARRAY_TOP;
 			sel->r.left = OV5647_PIXEL_ARRAY_LEFT;
 			sel->r.width = OV5647_PIXEL_ARRAY_WIDTH;
 			sel->r.height = OV5647_PIXEL_ARRAY_HEIGHT;
-			printk("ov5647 :: get_selection - return 0");
 			return 0;
 	}
-	printk("ov5647 :: get_selection - invalid target :  %d", sel->target);
-	printk("ov5647 :: get_selection - return -EINVAL");
 	return -EINVAL;
 }
 
+/*
+ * Read out only a region of interest of the active mode's field of view.
+ * The output size becomes the region divided by the mode's skip factor, and
+ * the frame length limits follow the smaller height.
+ */
+static int set_selection(struct v4l2_subdev *sd,
+			 struct v4l2_subdev_state *sd_state,
+			 struct v4l2_subdev_selection *sel)
+{
+	struct ov5647 *ov5647 = to_ov5647(sd);
+	const struct ov5647_mode *mode;
+	struct v4l2_mbus_framefmt *try_fmt;
+	int ret = 0;
+
+	if (sel->target != V4L2_SEL_TGT_CROP || sel->pad != 0)
+		return -EINVAL;
+
+	mutex_lock(&ov5647->mutex);
+	mode = ov5647->mode;
+	ov5647_adjust_roi(mode, &sel->r);
+
+	if (sel->which == V4L2_SUBDEV_FORMAT_TRY) {
+		*v4l2_subdev_get_try_crop(sd, sd_state, sel->pad) = sel->r;
+		try_fmt = v4l2_subdev_get_try_format(sd, sd_state, sel->pad);
+		try_fmt->width = sel->r.width / (mode->crop.width / mode->width);
+		try_fmt->height = sel->r.height / (mode->crop.height / mode->height);
+	} else if (ov5647->streaming) {
+		ret = -EBUSY;
+	} else {
+		ov5647->crop = sel->r;
+		ov5647->width = sel->r.width / ov5647->skip_x;
+		ov5647->height = sel->r.height / ov5647->skip_y;
+		ov5647_update_limits(ov5647);
+	}
+
+	mutex_unlock(&ov5647->mutex);
+	return ret;
+}
+
+/* Modes sharing a size are listed once, under the first of them */
+static bool ov5647_size_listed(const struct ov5647_mode *mode)
+{
+	const struct ov5647_mode *m;
+
+	for (m = supported_modes; m < mode; m++)
+		if (m->width == mode->width && m->height == mode->height)
+			return true;
+
+	return false;
+}
+
+static const struct ov5647_mode *ov5647_nth_size(unsigned int index)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(supported_modes); i++) {
+		if (ov5647_size_listed(&supported_modes[i]))
+			continue;
+		if (index-- == 0)
+			return &supported_modes[i];
+	}
+
+	return NULL;
+}
+
 static int enum_frame_size(struct v4l2_subdev *sd,
 				  struct v4l2_subdev_state *sd_state,
 				  struct v4l2_subdev_frame_size_enum *fse)
 {
-	struct ov5647 *ov5647 = to_ov5647(sd);
-	printk("ov5647 :: enum_frame_size");
+	const struct ov5647_mode *mode;
 
-	if (fse->pad == 0) {
-		printk("ov5647 :: enum_frame_size - fse->pad == 0");
-		if (fse->index >= ARRAY_SIZE(supported_modes)) {
-			printk("ov5647 :: enum_frame_size - fse->index > supported modes number");
-			return -EINVAL;
-		}
+	mode = ov5647_nth_size(fse->index);
+	if (!mode)
+		return -EINVAL;
+
+	if (!ov5647_code_supported(fse->code))
+		return -EINVAL;
+
+	fse->min_width = mode->width;
+	fse->max_width = fse->min_width;
+	fse->min_height = mode->height;
+	fse->max_height = fse->min_height;
+
+	return 0;
+}
+
+/* Frame rates offered by enum_frame_interval when a mode can reach them */
+static const unsigned int ov5647_std_fps[] = {
+	120, 90, 60, 50, 30, 25, 24, 20, 15, 10, 5,
+};
+
+/* Exact frame interval of a mode at a given VTS: HTS * VTS / pixel rate */
+static void ov5647_vts_to_interval(const struct ov5647_mode *mode, u64 rate,
+				   u32 vts, struct v4l2_fract *interval)
+{
+	u64 num = (u64)mode->hts_def * vts;
+	u64 den = rate;
+	unsigned long div = gcd(num, den);
+
+	interval->numerator = div_u64(num, div);
+	interval->denominator = div_u64(den, div);
+}
+
+static u32 ov5647_interval_to_vts(const struct ov5647_mode *mode, u64 rate,
+				  unsigned int height,
+				  const struct v4l2_fract *interval)
+{
+	u64 vts;
+
+	if (!interval->numerator || !interval->denominator)
+		return mode->vts_def;
 
-		mutex_lock(&ov5647->mutex);
-		if (fse->code != MEDIA_BUS_FMT_SBGGR10_1X10) {
-			printk("ov5647 :: enum_frame_size - fse->code != MEDIA_BUS_FMT_SBGGR10_1X10");
-			return -EINVAL;
+	vts = DIV_ROUND_CLOSEST_ULL(rate * interval->numerator,
+				    (u64)mode->hts_def * interval->denominator);
+
+	return clamp_t(u64, vts, height + OV5647_VBLANK_MIN, OV5647_VTS_MAX);
+}
+
+/*
+ * Achievable frame lengths of a mode, fastest first: the shortest frame,
+ * then the VTS closest to each standard rate the mode can run at.
+ */
+static int ov5647_enum_vts(const struct ov5647_mode *mode, u64 rate,
+			   unsigned int index, u32 *vts)
+{
+	u32 vts_min = mode->height + OV5647_VBLANK_MIN;
+	u32 prev = vts_min;
+	unsigned int i;
+
+	if (index == 0) {
+		*vts = vts_min;
+		return 0;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(ov5647_std_fps); i++) {
+		u32 v = DIV_ROUND_CLOSEST_ULL(rate,
+					      (u64)mode->hts_def * ov5647_std_fps[i]);
+
+		if (v <= prev || v > OV5647_VTS_MAX)
+			continue;
+		prev = v;
+		if (--index == 0) {
+			*vts = v;
+			return 0;
 		}
-		mutex_unlock(&ov5647->mutex);
-		
-		fse	->min_width = supported_modes[fse->index].width;
-		fse->max_width = fse->min_width;
-		fse->min_height = supported_modes[fse->index].height;
-		fse->max_height = fse->min_height;
-	} else {
-		printk("ov5647 :: enum_frame_size - fse->pad != 0");
+	}
+
+	return -EINVAL;
+}
+
+static int enum_frame_interval(struct v4l2_subdev *sd,
+			       struct v4l2_subdev_state *sd_state,
+			       struct v4l2_subdev_frame_interval_enum *fie)
+{
+	struct ov5647 *ov5647 = to_ov5647(sd);
+	const struct ov5647_mode *mode;
+	struct v4l2_fract fastest = { 0, 1 };
+	struct v4l2_fract interval;
+	unsigned int index = fie->index;
+	unsigned int i;
+	u64 rate;
+	u32 vts;
+
+	if (fie->pad != 0 || !ov5647_code_supported(fie->code))
 		return -EINVAL;
+
+	/*
+	 * Walk every mode of this size in table order. A later, faster mode
+	 * only adds the intervals the earlier ones cannot reach.
+	 */
+	for (mode = supported_modes;
+	     mode < supported_modes + ARRAY_SIZE(supported_modes); mode++) {
+		if (mode->width != fie->width || mode->height != fie->height)
+			continue;
+
+		rate = ov5647_mode_rate(ov5647, mode, ov5647_code_bpp(fie->code));
+		for (i = 0; !ov5647_enum_vts(mode, rate, i, &vts); i++) {
+			ov5647_vts_to_interval(mode, rate, vts, &interval);
+			if (fastest.numerator &&
+			    (u64)interval.numerator * fastest.denominator >=
+			    (u64)fastest.numerator * interval.denominator)
+				continue;
+			if (index-- == 0) {
+				fie->interval = interval;
+				return 0;
+			}
+		}
+
+		ov5647_enum_vts(mode, rate, 0, &vts);
+		ov5647_vts_to_interval(mode, rate, vts, &fastest);
+	}
+
+	return -EINVAL;
+}
+
+/*
+ * The first mode of the active size that can run at interval, or the
+ * fastest one of that size when none can.
+ */
+static const struct ov5647_mode *
+ov5647_mode_for_interval(struct ov5647 *ov5647, const struct v4l2_fract *interval)
+{
+	const struct ov5647_mode *mode, *best = ov5647->mode;
+	unsigned int bpp = ov5647_bpp(ov5647);
+	u32 vts_min;
+	u64 vts;
+
+	if (!interval->numerator || !interval->denominator)
+		return ov5647->mode;
+
+	for (mode = supported_modes;
+	     mode < supported_modes + ARRAY_SIZE(supported_modes); mode++) {
+		if (mode->width != ov5647->mode->width ||
+		    mode->height != ov5647->mode->height ||
+		    !ov5647_mode_carried(ov5647, mode))
+			continue;
+
+		/* The active mode may be reading out a shorter region */
+		vts_min = (mode == ov5647->mode ? ov5647->height : mode->height) +
+			  OV5647_VBLANK_MIN;
+		vts = DIV_ROUND_CLOSEST_ULL(ov5647_mode_rate(ov5647, mode, bpp) *
+					    interval->numerator,
+					    (u64)mode->hts_def * interval->denominator);
+		if (vts >= vts_min)
+			return mode;
+		if (ov5647_mode_rate(ov5647, mode, bpp) >
+		    ov5647_mode_rate(ov5647, best, bpp))
+			best = mode;
 	}
 
-	printk("ov5647 :: enum_frame_size - return 0");
+	return best;
+}
+
+static int ov5647_g_frame_interval(struct v4l2_subdev *sd,
+				   struct v4l2_subdev_frame_interval *fi)
+{
+	struct ov5647 *ov5647 = to_ov5647(sd);
+
+	if (fi->pad != 0)
+		return -EINVAL;
+
+	mutex_lock(&ov5647->mutex);
+	ov5647_vts_to_interval(ov5647->mode, ov5647_pixel_rate(ov5647),
+			       ov5647->height + ov5647->vblank->val,
+			       &fi->interval);
+	mutex_unlock(&ov5647->mutex);
+
 	return 0;
 }
 
+/*
+ * Program the frame length closest to the requested interval through the
+ * VBLANK control and report the interval actually achieved. When the active
+ * mode cannot go that fast, a faster mode of the same size takes over. A
+ * generated mode is rebuilt for the new rate. Either way the link then
+ * drops to the slowest configuration that still makes the rate.
+ */
+static int ov5647_s_frame_interval(struct v4l2_subdev *sd,
+				   struct v4l2_subdev_frame_interval *fi)
+{
+	struct ov5647 *ov5647 = to_ov5647(sd);
+	const struct ov5647_mode *mode;
+	u64 rate;
+	u32 vts;
+	int ret;
+
+	if (fi->pad != 0)
+		return -EINVAL;
+
+	mutex_lock(&ov5647->mutex);
+	if (ov5647->mode == &ov5647->gen_mode && !ov5647->streaming &&
+	    fi->interval.numerator && fi->interval.denominator) {
+		ret = ov5647_use_gen_mode(ov5647, ov5647->gen_mode.width,
+					  ov5647->gen_mode.height,
+					  DIV_ROUND_UP(fi->interval.denominator,
+						       fi->interval.numerator));
+		if (ret) {
+			mutex_unlock(&ov5647->mutex);
+			return ret;
+		}
+	}
+
+	mode = ov5647_mode_for_interval(ov5647, &fi->interval);
+	if (mode != ov5647->mode) {
+		/* Switching to a same-size mode with a different PLL */
+		if (ov5647->streaming) {
+			mutex_unlock(&ov5647->mutex);
+			return -EBUSY;
+		}
+		ov5647_update_mode(ov5647, mode);
+	}
+
+	/* The PLL only changes between streams */
+	if (!ov5647->streaming) {
+		ov5647->link_idx = ov5647_link_for_interval(ov5647, mode,
+							    ov5647->height,
+							    &fi->interval);
+		ov5647_update_link_ctrls(ov5647);
+	}
+
+	rate = ov5647_pixel_rate(ov5647);
+	vts = ov5647_interval_to_vts(mode, rate, ov5647->height, &fi->interval);
+	ret = __v4l2_ctrl_s_ctrl(ov5647->vblank, vts - ov5647->height);
+	if (!ret) {
+		ov5647_update_exposure_range(ov5647);
+		ov5647_vts_to_interval(mode, rate, vts, &fi->interval);
+	}
+	mutex_unlock(&ov5647->mutex);
+
+	return ret;
+}
+
 //-------------------------------------
 
+static int ov5647_subscribe_event(struct v4l2_subdev *sd, struct v4l2_fh *fh,
+				  struct v4l2_event_subscription *sub)
+{
+	if (sub->type == V4L2_EVENT_OV5647_CTRLS_APPLIED ||
+	    sub->type == V4L2_EVENT_FRAME_SYNC)
+		return v4l2_event_subscribe(fh, sub, 4, NULL);
+
+	return v4l2_ctrl_subdev_subscribe_event(sd, fh, sub);
+}
+
+/*
+ * Metadata of frame meta->sequence: the newest record at or before it.
+ * -EAGAIN for a frame that has not started yet, -ENODATA once the frame is
+ * older than every record kept.
+ */
+static int ov5647_g_frame_meta(struct ov5647 *ov5647,
+			       struct ov5647_frame_meta *meta)
+{
+	const struct ov5647_frame_meta *m;
+	u32 sequence = meta->sequence;
+	int ret = 0;
+
+	mutex_lock(&ov5647->mutex);
+	if (ov5647->streaming &&
+	    sequence > ov5647_meta_frame(ov5647, ktime_get_ns())) {
+		ret = -EAGAIN;
+		goto out_unlock;
+	}
+
+	m = ov5647_meta_find(ov5647, sequence);
+	if (!m) {
+		ret = -ENODATA;
+		goto out_unlock;
+	}
+
+	*meta = *m;
+	meta->sequence = sequence;
+	meta->timestamp = ov5647_meta_start(ov5647, m, sequence);
+
+out_unlock:
+	mutex_unlock(&ov5647->mutex);
+	return ret;
+}
+
+/* Queue a control set for a future frame, merging with one already queued */
+static int ov5647_queue_frame_ctrls(struct ov5647 *ov5647,
+				    const struct ov5647_frame_ctrls *fc)
+{
+	struct ov5647_frame_ctrls *q = ov5647->frame_ctrls;
+	unsigned int i;
+	int ret = 0;
+
+	if (!fc->which || fc->which & ~OV5647_FRAME_CTRLS_MASK)
+		return -EINVAL;
+
+	mutex_lock(&ov5647->mutex);
+	if (!ov5647->streaming) {
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	/*
+	 * The exposure maximum follows the current frame length, while a
+	 * queued set may lengthen its own frame: bound it by the longest frame
+	 * and let ov5647_apply_ctrls() fit it, as the metadata then reports.
+	 */
+	if ((fc->which & BIT(OV5647_BATCH_EXPOSURE) &&
+	     (fc->exposure < ov5647->exposure->minimum ||
+	      fc->exposure > OV5647_VTS_MAX - OV5647_EXPOSURE_MARGIN)) ||
+	    (fc->which & BIT(OV5647_BATCH_GAIN) &&
+	     (fc->gain < ov5647->gain->minimum ||
+	      fc->gain > ov5647->gain->maximum)) ||
+	    (fc->which & BIT(OV5647_BATCH_VBLANK) &&
+	     (fc->vblank < ov5647->vblank->minimum ||
+	      fc->vblank > ov5647->vblank->maximum))) {
+		ret = -ERANGE;
+		goto out_unlock;
+	}
+
+	/* Written now it would land on this frame, anything earlier is lost */
+	if (fc->sequence < ov5647_meta_frame(ov5647, ktime_get_ns()) +
+			   OV5647_GROUP_DELAY_FRAMES) {
+		ret = -ETIME;
+		goto out_unlock;
+	}
+
+	for (i = 0; i < ov5647->num_frame_ctrls; i++)
+		if (q[i].sequence >= fc->sequence)
+			break;
+
+	if (i < ov5647->num_frame_ctrls && q[i].sequence == fc->sequence) {
+		if (fc->which & BIT(OV5647_BATCH_EXPOSURE))
+			q[i].exposure = fc->exposure;
+		if (fc->which & BIT(OV5647_BATCH_GAIN))
+			q[i].gain = fc->gain;
+		if (fc->which & BIT(OV5647_BATCH_VBLANK))
+			q[i].vblank = fc->vblank;
+		q[i].which |= fc->which;
+	} else if (ov5647->num_frame_ctrls == OV5647_FRAME_CTRLS_DEPTH) {
+		ret = -EBUSY;
+		goto out_unlock;
+	} else {
+		memmove(&q[i + 1], &q[i],
+			(ov5647->num_frame_ctrls - i) * sizeof(*q));
+		q[i] = *fc;
+		ov5647->num_frame_ctrls++;
+	}
+
+	ov5647_frame_ctrls_schedule(ov5647);
+
+out_unlock:
+	mutex_unlock(&ov5647->mutex);
+	return ret;
+}
+
+static void ov5647_g_ctrl_delays(struct ov5647_ctrl_delays *delays)
+{
+	/* All three go out under one group hold */
+	delays->exposure = OV5647_GROUP_DELAY_FRAMES;
+	delays->gain = OV5647_GROUP_DELAY_FRAMES;
+	delays->vblank = OV5647_GROUP_DELAY_FRAMES;
+}
+
+static long ov5647_ioctl(struct v4l2_subdev *sd, unsigned int cmd, void *arg)
+{
+	switch (cmd) {
+	case VIDIOC_OV5647_G_FRAME_META:
+		return ov5647_g_frame_meta(to_ov5647(sd), arg);
+	case VIDIOC_OV5647_QUEUE_FRAME_CTRLS:
+		return ov5647_queue_frame_ctrls(to_ov5647(sd), arg);
+	case VIDIOC_OV5647_G_CTRL_DELAYS:
+		ov5647_g_ctrl_delays(arg);
+		return 0;
+	default:
+		return -ENOIOCTLCMD;
+	}
+}
+
 static const struct v4l2_subdev_core_ops core_ops = {
-	.subscribe_event = v4l2_ctrl_subdev_subscribe_event,
+	.ioctl = ov5647_ioctl,
+	.subscribe_event = ov5647_subscribe_event,
 	.unsubscribe_event = v4l2_event_subdev_unsubscribe,
 };
 
 static const struct v4l2_subdev_video_ops video_ops = {
 	.s_stream = ov5647_set_stream,
+	.g_frame_interval = ov5647_g_frame_interval,
+	.s_frame_interval = ov5647_s_frame_interval,
 };
 
 static const struct v4l2_subdev_pad_ops pad_ops = {
@@ -1537,7 +3865,9 @@ static const struct v4l2_subdev_pad_ops pad_ops = {
 	.get_fmt = get_pad_format,
 	.set_fmt = set_pad_format,
 	.get_selection = get_selection,
+	.set_selection = set_selection,
 	.enum_frame_size = enum_frame_size,
+	.enum_frame_interval = enum_frame_interval,
 };
 
 static const struct v4l2_subdev_ops subdev_ops = {
@@ -1556,21 +3886,49 @@ static int check_hwcfg(struct ov5647 *ov5647, struct device_node *np)
 	struct v4l2_fwnode_endpoint bus_cfg = {
 		.bus_type = V4L2_MBUS_CSI2_DPHY,
 	};
+	struct i2c_client *client = v4l2_get_subdevdata(&ov5647->sd);
 	struct device_node *ep;
+	unsigned long mask = 0;
+	unsigned int i, j;
 	int ret;
 
 	ep = of_graph_get_next_endpoint(np, NULL);
 	if (!ep)
 		return -EINVAL;
 
-	ret = v4l2_fwnode_endpoint_parse(of_fwnode_handle(ep), &bus_cfg);
+	ret = v4l2_fwnode_endpoint_alloc_parse(of_fwnode_handle(ep), &bus_cfg);
 	if (ret)
 		goto out;
 
 	ov5647->clock_ncont = bus_cfg.bus.mipi_csi2.flags &
 			      V4L2_MBUS_CSI2_NONCONTINUOUS_CLOCK;
 
+	ov5647->lanes = bus_cfg.bus.mipi_csi2.num_data_lanes;
+	if (ov5647->lanes != 1 && ov5647->lanes != OV5647_MAX_LANES) {
+		dev_err(&client->dev, "unsupported data-lanes count: %u\n",
+			ov5647->lanes);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	/* link-frequencies is optional; when present it limits the menu */
+	if (bus_cfg.nr_of_link_frequencies) {
+		for (i = 0; i < bus_cfg.nr_of_link_frequencies; i++)
+			for (j = 0; j < ARRAY_SIZE(ov5647_link_freq_menu); j++)
+				if (bus_cfg.link_frequencies[i] ==
+				    ov5647_link_freq_menu[j])
+					__set_bit(j, &mask);
+
+		if (!mask) {
+			dev_err(&client->dev, "no supported link-frequencies\n");
+			ret = -EINVAL;
+			goto out;
+		}
+		ov5647->link_freq_mask = mask;
+	}
+
 out:
+	v4l2_fwnode_endpoint_free(&bus_cfg);
 	of_node_put(ep);
 
 	return ret;
@@ -1581,28 +3939,41 @@ static int ov5647_probe(struct i2c_client *client)
 	struct device* dev;
 	struct ov5647* ov5647;
 	struct device_node *np;
+	bool lazy = lazy_detect;
+	char name[32];
 	int ret;
 
-	printk("ov5647_probe");
 	ret = 0;
 	dev = &client->dev;
 
-	printk("ov5647_probe:: devm_kzalloc ");
 	ov5647 = devm_kzalloc(dev, sizeof(*ov5647), GFP_KERNEL);
 	if (!ov5647)
 		return -ENOMEM;
 
 /* Initialize subdev */
-	printk("ov5647_probe:: Initialize subdev ");
 	v4l2_i2c_subdev_init(&ov5647->sd, client, &subdev_ops);
 	ov5647->sd.internal_ops = &ov5647_internal_ops;
 	ov5647->sd.flags |= V4L2_SUBDEV_FL_HAS_DEVNODE |
 			    V4L2_SUBDEV_FL_HAS_EVENTS;
 	ov5647->sd.entity.function = MEDIA_ENT_F_CAM_SENSOR;
+	ov5647_init_xfer_limits(ov5647, client);
+	INIT_WORK(&ov5647->ctrl_work, ov5647_ctrl_work);
+	INIT_WORK(&ov5647->frame_ctrls_work, ov5647_frame_ctrls_work);
+	spin_lock_init(&ov5647->timeline_lock);
+	spin_lock_init(&ov5647->frame_lock);
+	hrtimer_init(&ov5647->frame_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	ov5647->frame_timer.function = ov5647_frame_timer;
+
+	ov5647->reg_cache = devm_kzalloc(dev, OV5647_CACHE_SIZE, GFP_KERNEL);
+	ov5647->reg_cache_valid = devm_bitmap_zalloc(dev, OV5647_CACHE_SIZE,
+						     GFP_KERNEL);
+	if (!ov5647->reg_cache || !ov5647->reg_cache_valid)
+		return -ENOMEM;
 
+	ov5647->link_freq_mask = GENMASK(ARRAY_SIZE(ov5647_link_freq_menu) - 1, 0);
+	ov5647->lanes = OV5647_MAX_LANES;
 	np = client->dev.of_node;
 	if (IS_ENABLED(CONFIG_OF) && np) {
-		printk("ov5647_probe:: check_hwcfg ");
 		ret = check_hwcfg(ov5647, np);
 		if (ret) {
 			dev_err(dev, "DT parsing error: %d\n", ret);
@@ -1611,74 +3982,75 @@ static int ov5647_probe(struct i2c_client *client)
 	}
 
 	/* Get system clock (xclk) */
-	printk("ov5647_probe:: devm_clk_get ");
 	ov5647->xclk = devm_clk_get(dev, NULL);
 	if (IS_ERR(ov5647->xclk)) {
-		printk( "ov5647_probe::failed to get xclk\n");
+		dev_err(dev, "failed to get xclk\n");
 		return PTR_ERR(ov5647->xclk);
 	}
 
 	/* Get clk rate freq (xclk_freq)*/
-	printk("ov5647_probe:: clk_get_rate ");
 	ov5647->xclk_freq = clk_get_rate(ov5647->xclk);
 	if (ov5647->xclk_freq != OV5647_XCLK_FREQ) {
-		printk("ov5647_probe::xclk frequency not supported: %d Hz\n",
+		dev_err(dev, "xclk frequency not supported: %d Hz\n",
 			ov5647->xclk_freq);
 		return -EINVAL;
 	}
 
 	/* Request optional pwr pin */
-	printk("ov5647_probe:: devm_gpiod_get_optional ");
 	ov5647->pwr_gpio = devm_gpiod_get_optional(dev, "pwdn", GPIOD_OUT_HIGH);
 	if (IS_ERR(ov5647->pwr_gpio)) {
-		printk("ov5647_probe :: error init the gpio pwr ");
+		dev_err(dev, "failed to get pwdn gpio\n");
 		return -EINVAL;
 	}
 
-	printk("ov5647_probe:: get_regulators ");
 	ret = get_regulators(ov5647, dev); 
 	if (ret) {
-		printk("ov5647_probe::failed to get regulators\n");
+		dev_err(dev, "failed to get regulators\n");
 		return ret;
 	}
 
+	/* Format first: the mode link, pixel rate and limits follow its depth */
+	set_default_format(ov5647);
+
 	/* Set default mode to max resolution */
-	printk("ov5647_probe:: Set default mode ");
 	ov5647->mode = &supported_modes[3];
+	if (!ov5647_mode_carried(ov5647, ov5647->mode)) {
+		ret = ov5647_gen_mode(ov5647->mode->width, ov5647->mode->height,
+				      OV5647_GEN_DEFAULT_FPS,
+				      ov5647_bpp(ov5647),
+				      ov5647->lanes, ov5647->link_freq_mask,
+				      &ov5647->gen_mode, ov5647->gen_regs);
+		if (ret)
+			return ret;
+		ov5647->mode = &ov5647->gen_mode;
+	}
+	ov5647->link_idx = ov5647_mode_link(ov5647, ov5647->mode);
+	ov5647_reset_roi(ov5647);
 
-	printk("ov5647_probe:: init_controls ");
 	ret = init_controls(ov5647);
-	if (ret)
-		goto error_power_off;
-
-	printk("ov5647_probe:: power_on ");
-	ret = power_on(dev);
 	if (ret)
 		return ret;
 
-	printk("ov5647_probe:: ov5647_identify_module ");
-	ret = ov5647_identify_module(ov5647);
-	if (ret)
-		goto error_power_off;
-
-
-	/* sensor doesn't enter LP-11 state upon power up until and unless
-	 * streaming is started, so upon power up switch the modes to:
-	 * streaming -> standby
+	/*
+	 * With lazy_detect the sensor stays powered down until first open or
+	 * stream on, otherwise it is identified here. The driver prefers
+	 * asynchronous probing, so either way boot does not wait on it.
 	 */
-	ret = ov5647_write_reg_8bit(ov5647, OV5647_REG_MIPI_CTRL00, MIPI_CTRL00_CLOCK_LANE_GATE 
-									| MIPI_CTRL00_BUS_IDLE | MIPI_CTRL00_CLOCK_LANE_DISABLE);
-	if (ret < 0)
-		goto error_power_off;
-
-		/* Initialize default format */
-	set_default_format(ov5647);
+	if (!lazy) {
+		ret = power_on(dev);
+		if (ret)
+			goto error_handler_free;
+
+		ret = ov5647_detect(ov5647);
+		if (ret)
+			goto error_power_off;
+	}
 
 /* Initialize source pad */
 	ov5647->pad.flags = MEDIA_PAD_FL_SOURCE;
 	ret = media_entity_pads_init(&ov5647->sd.entity, 1, &ov5647->pad);
 	if (ret < 0)
-		goto error_handler_free;
+		goto error_power_off;
 
 	ret = v4l2_async_register_subdev_sensor(&ov5647->sd);
 	if (ret < 0) {
@@ -1686,25 +4058,31 @@ static int ov5647_probe(struct i2c_client *client)
 		goto error_media_entity;
 	}
 
-	/* Enable runtime PM and turn off the device */
-	pm_runtime_set_active(dev);
+	/* Enable runtime PM and turn off the device once the delay expires */
+	if (!lazy)
+		pm_runtime_set_active(dev);
 	pm_runtime_enable(dev);
+	pm_runtime_set_autosuspend_delay(dev, OV5647_AUTOSUSPEND_DELAY_MS);
+	pm_runtime_use_autosuspend(dev);
 	pm_runtime_idle(dev);
 
+	snprintf(name, sizeof(name), "ov5647-%s", dev_name(dev));
+	ov5647->debugfs = debugfs_create_dir(name, NULL);
+	debugfs_create_file("power_timeline", 0444, ov5647->debugfs, ov5647,
+			    &ov5647_timeline_fops);
+
 	return 0;
 
 error_media_entity:
-	printk("ov5647_probe :: error_media_entity ");
 	media_entity_cleanup(&ov5647->sd.entity);
 
+error_power_off:
+	if (!lazy)
+		power_off(dev);
+
 error_handler_free:
-	printk("ov5647_probe :: error_handler_free ");
 	free_controls(ov5647);
 
-error_power_off:
-	printk("ov5647_probe :: error_power_off ");
-	power_off(dev);
-
 	return ret;
 }
 
@@ -1713,11 +4091,17 @@ static void ov5647_remove(struct i2c_client *client)
 	struct v4l2_subdev *sd = i2c_get_clientdata(client);
 	struct ov5647 *ov5647 = to_ov5647(sd);
 
+	debugfs_remove_recursive(ov5647->debugfs);
 	v4l2_async_unregister_subdev(sd);
+	/* The timer queues frame_ctrls_work, so stop it first */
+	hrtimer_cancel(&ov5647->frame_timer);
+	cancel_work_sync(&ov5647->ctrl_work);
+	cancel_work_sync(&ov5647->frame_ctrls_work);
 	media_entity_cleanup(&sd->entity);
 	free_controls(ov5647);
 
 	pm_runtime_disable(&client->dev);
+	pm_runtime_dont_use_autosuspend(&client->dev);
 	if (!pm_runtime_status_suspended(&client->dev))
 		power_off(&client->dev);
 	pm_runtime_set_suspended(&client->dev);
@@ -1740,6 +4124,7 @@ static struct i2c_driver ov5647_i2c_driver = {
 		.name = "ov5647",
 		.of_match_table	= ov5647_dt_ids,
 		.pm = &ov5647_pm_ops,
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 	},
 	.probe_new = ov5647_probe,
 	.remove = ov5647_remove,
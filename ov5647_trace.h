@@ -0,0 +1,166 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ov5647
+
+#if !defined(_OV5647_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _OV5647_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* Single register access that went out on the bus */
+DECLARE_EVENT_CLASS(ov5647_reg,
+	TP_PROTO(u16 reg, u8 val, s64 duration_ns, int err),
+	TP_ARGS(reg, val, duration_ns, err),
+	TP_STRUCT__entry(
+		__field(u16, reg)
+		__field(u8, val)
+		__field(s64, duration_ns)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__entry->reg = reg;
+		__entry->val = val;
+		__entry->duration_ns = duration_ns;
+		__entry->err = err;
+	),
+	TP_printk("reg=0x%04x val=0x%02x duration=%lldns err=%d",
+		  __entry->reg, __entry->val, __entry->duration_ns,
+		  __entry->err)
+);
+
+DEFINE_EVENT(ov5647_reg, ov5647_reg_write,
+	TP_PROTO(u16 reg, u8 val, s64 duration_ns, int err),
+	TP_ARGS(reg, val, duration_ns, err)
+);
+
+DEFINE_EVENT(ov5647_reg, ov5647_reg_read,
+	TP_PROTO(u16 reg, u8 val, s64 duration_ns, int err),
+	TP_ARGS(reg, val, duration_ns, err)
+);
+
+/* Register sequence: entries asked for, entries sent after the cache */
+TRACE_EVENT(ov5647_reg_seq,
+	TP_PROTO(u16 first, unsigned int regs, unsigned int written,
+		 unsigned int msgs, unsigned int bytes, s64 duration_ns, int err),
+	TP_ARGS(first, regs, written, msgs, bytes, duration_ns, err),
+	TP_STRUCT__entry(
+		__field(u16, first)
+		__field(unsigned int, regs)
+		__field(unsigned int, written)
+		__field(unsigned int, msgs)
+		__field(unsigned int, bytes)
+		__field(s64, duration_ns)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__entry->first = first;
+		__entry->regs = regs;
+		__entry->written = written;
+		__entry->msgs = msgs;
+		__entry->bytes = bytes;
+		__entry->duration_ns = duration_ns;
+		__entry->err = err;
+	),
+	TP_printk("first=0x%04x regs=%u written=%u msgs=%u bytes=%u duration=%lldns err=%d",
+		  __entry->first, __entry->regs, __entry->written,
+		  __entry->msgs, __entry->bytes, __entry->duration_ns,
+		  __entry->err)
+);
+
+TRACE_EVENT(ov5647_stream,
+	TP_PROTO(int enable, s64 duration_ns, int err),
+	TP_ARGS(enable, duration_ns, err),
+	TP_STRUCT__entry(
+		__field(int, enable)
+		__field(s64, duration_ns)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__entry->enable = enable;
+		__entry->duration_ns = duration_ns;
+		__entry->err = err;
+	),
+	TP_printk("%s duration=%lldns err=%d",
+		  __entry->enable ? "on" : "off", __entry->duration_ns,
+		  __entry->err)
+);
+
+TRACE_EVENT(ov5647_mode_change,
+	TP_PROTO(u32 width, u32 height, bool full, unsigned int regs, int err),
+	TP_ARGS(width, height, full, regs, err),
+	TP_STRUCT__entry(
+		__field(u32, width)
+		__field(u32, height)
+		__field(bool, full)
+		__field(unsigned int, regs)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__entry->width = width;
+		__entry->height = height;
+		__entry->full = full;
+		__entry->regs = regs;
+		__entry->err = err;
+	),
+	TP_printk("%ux%u %s load regs=%u err=%d",
+		  __entry->width, __entry->height,
+		  __entry->full ? "full" : "delta", __entry->regs, __entry->err)
+);
+
+/*
+ * Exposure cluster launched under group hold. latency_frames/latency_ns is
+ * the control-to-frame latency: when the first frame carrying the values
+ * starts, counted from the launch.
+ */
+TRACE_EVENT(ov5647_group_hold,
+	TP_PROTO(u32 exposure, u32 gain, u32 vts, unsigned int latency_frames,
+		 u64 latency_ns, int err),
+	TP_ARGS(exposure, gain, vts, latency_frames, latency_ns, err),
+	TP_STRUCT__entry(
+		__field(u32, exposure)
+		__field(u32, gain)
+		__field(u32, vts)
+		__field(unsigned int, latency_frames)
+		__field(u64, latency_ns)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__entry->exposure = exposure;
+		__entry->gain = gain;
+		__entry->vts = vts;
+		__entry->latency_frames = latency_frames;
+		__entry->latency_ns = latency_ns;
+		__entry->err = err;
+	),
+	TP_printk("exposure=%u gain=%u vts=%u latency=%u frames (%lluns) err=%d",
+		  __entry->exposure, __entry->gain, __entry->vts,
+		  __entry->latency_frames, __entry->latency_ns, __entry->err)
+);
+
+/* Control value; applied is false when the sensor was not powered */
+TRACE_EVENT(ov5647_ctrl,
+	TP_PROTO(u32 id, s32 val, bool applied, int err),
+	TP_ARGS(id, val, applied, err),
+	TP_STRUCT__entry(
+		__field(u32, id)
+		__field(s32, val)
+		__field(bool, applied)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->val = val;
+		__entry->applied = applied;
+		__entry->err = err;
+	),
+	TP_printk("id=0x%x val=%d applied=%d err=%d",
+		  __entry->id, __entry->val, __entry->applied, __entry->err)
+);
+
+#endif /* _OV5647_TRACE_H */
+
+/* The driver is built from drivers/media/i2c in the kernel tree */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH ../../drivers/media/i2c
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ov5647_trace
+#include <trace/define_trace.h>